@@ -0,0 +1,114 @@
+#!/bin/sh
+# ============================================================================
+# Лабораторная работа №3 - Бенчмарк пропускной способности (make bench)
+#
+# Генерирует корпуса (build/gen), прогоняет build/parent + build/child от
+# начала до конца REPS раз на каждую пару "корпус x режим" и печатает по
+# одной JSON-строке на пару - их удобно дописывать в файл и сравнивать
+# между коммитами:
+#
+#   {"commit":"e4375ec","corpus":"8M_t8_d6","mode":"--ring","bytes":...,
+#    "lines":...,"runs":11,"p50_ms":...,"p99_ms":...,"min_ms":...,
+#    "mb_s":...,"lines_s":...}
+#
+# p50/p99 - время одного полного прогона (nearest rank по REPS прогонам;
+# при малом REPS p99 - фактически максимум). mb_s и lines_s считаются по p50.
+#
+# Настройка через переменные окружения (или make bench SIZES=...):
+#   SIZES  - объёмы корпусов, "64K 8M 128M" (суффиксы K/M/G, хоть 20G)
+#   MODES  - режимы parent через ";", по умолчанию "; --ring; -j N; --zero-copy -j N"
+#   REPS   - прогонов на пару (по умолчанию 11)
+#   TOKENS, DIGITS, NEG, EXP, SEED - форма корпуса (см. bench/gen.c)
+#   FORMAT - text (по умолчанию), bin32 или bin64: прогонять двоичную копию
+#            корпуса (build/txt2bin, тоже кэшируется); bytes - размер текста
+#   BENCH_DIR - где хранить корпуса (по умолчанию /tmp/os_lab3_bench;
+#               корпус с теми же параметрами генерируется один раз)
+#   OUT    - дописать результаты ещё и в этот файл
+# ============================================================================
+
+set -eu
+
+cd "$(dirname "$0")/.."                      # Корень репозитория: здесь build/ и корпуса по относительным путям
+
+NPROC=$(nproc 2>/dev/null || echo 1)
+SIZES=${SIZES:-"64K 8M 128M"}
+MODES=${MODES:-"; --ring; -j $NPROC; --zero-copy -j $NPROC"}
+REPS=${REPS:-11}
+TOKENS=${TOKENS:-8}
+DIGITS=${DIGITS:-6}
+NEG=${NEG:-25}
+EXP=${EXP:-5}
+SEED=${SEED:-1}
+FORMAT=${FORMAT:-text}
+BENCH_DIR=${BENCH_DIR:-/tmp/os_lab3_bench}
+OUT=${OUT:-}
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p "$BENCH_DIR"
+
+# now_ns - монотонное время в наносекундах (date +%s%N - GNU)
+now_ns() {
+    date +%s%N
+}
+
+for size in $SIZES; do
+    corpus="${size}_t${TOKENS}_d${DIGITS}_n${NEG}_e${EXP}_s${SEED}"
+    file="$BENCH_DIR/$corpus.txt"
+    if [ ! -f "$file" ]; then                # Генерируем один раз, дальше - из кэша
+        echo "bench: generating $file" >&2
+        ./build/gen --size "$size" --tokens "$TOKENS" --digits "$DIGITS" \
+            --neg "$NEG" --exp "$EXP" --seed "$SEED" -o "$file.tmp"
+        mv "$file.tmp" "$file"
+    fi
+    bytes=$(wc -c < "$file")
+    lines=$(wc -l < "$file")
+
+    case "$FORMAT" in                        # Двоичная копия: те же строки, числа уже разобраны
+        text) input="$file" ;;
+        bin32|bin64)
+            input="$BENCH_DIR/$corpus.$FORMAT"
+            if [ ! -f "$input" ]; then
+                echo "bench: converting $file to $FORMAT" >&2
+                if [ "$FORMAT" = bin64 ]; then ./build/txt2bin --f64 "$file" "$input.tmp"; else ./build/txt2bin "$file" "$input.tmp"; fi
+                mv "$input.tmp" "$input"
+            fi
+            corpus="$corpus.$FORMAT"
+            ;;
+        *) echo "bench: FORMAT must be text, bin32 or bin64" >&2; exit 1 ;;
+    esac
+
+    echo "$MODES" | tr ';' '\n' | while IFS= read -r mode; do
+        mode=$(echo "$mode" | sed 's/^ *//; s/ *$//')
+        times="$BENCH_DIR/times.$$"
+        : > "$times"
+
+        i=0
+        while [ "$i" -lt "$REPS" ]; do
+            start=$(now_ns)
+            # shellcheck disable=SC2086       # mode - несколько аргументов
+            sums=$(printf '%s\n' "$input" | ./build/parent $mode | grep -c '^Sum: ' || true)
+            end=$(now_ns)
+            if [ "$sums" -ne "$lines" ]; then # Быстро, но неправильно - не результат
+                echo "bench: [$mode] on $corpus printed $sums results for $lines lines" >&2
+                rm -f "$times"
+                exit 1
+            fi
+            echo $(( (end - start) / 1000 )) >> "$times" # Микросекунды
+            i=$((i + 1))
+        done
+
+        line=$(sort -n "$times" | awk -v commit="$COMMIT" -v corpus="$corpus" -v mode="$mode" \
+                                      -v bytes="$bytes" -v lines="$lines" '
+            { t[NR] = $1 }
+            END {
+                p50 = t[int((NR * 50 + 99) / 100)]  # nearest rank: ceil(N * p / 100)
+                p99 = t[int((NR * 99 + 99) / 100)]
+                printf "{\"commit\":\"%s\",\"corpus\":\"%s\",\"mode\":\"%s\",\"bytes\":%d,\"lines\":%d,", commit, corpus, mode, bytes, lines
+                printf "\"runs\":%d,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"min_ms\":%.3f,", NR, p50 / 1000, p99 / 1000, t[1] / 1000
+                printf "\"mb_s\":%.2f,\"lines_s\":%.0f}\n", bytes / p50, lines / (p50 / 1e6)
+            }')
+        rm -f "$times"
+        echo "$line"
+        if [ -n "$OUT" ]; then echo "$line" >> "$OUT"; fi
+    done
+done
@@ -0,0 +1,149 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Генератор входных данных для бенчмарка (gen)
+ *
+ * Печатает в stdout (или в файл -o) строки чисел через пробел - такой же
+ * формат, как test.txt, но любого объёма: от килобайт до десятков гигабайт.
+ * Данные пишутся потоком блоками по GEN_BUF байт, память не растёт.
+ *
+ * Запуск: gen [--lines N | --size N[K|M|G]] [--tokens N] [--digits N]
+ *             [--neg P] [--exp P] [--seed N] [-o FILE]
+ *   --lines  - число строк (по умолчанию 1000)
+ *   --size   - вместо --lines: писать строки, пока не наберётся N байт
+ *   --tokens - чисел в строке (по умолчанию 8)
+ *   --digits - значащих цифр в числе (по умолчанию 6), точка - в случайном месте
+ *   --neg    - процент отрицательных чисел (по умолчанию 25)
+ *   --exp    - процент чисел в экспоненциальной записи, 1.5e-3 (по умолчанию 5)
+ *   --seed   - зерно генератора: один и тот же seed - один и тот же файл
+ * ============================================================================
+ */
+
+#define _GNU_SOURCE                          // syscall() в common.h (futex режима --ring)
+#define _POSIX_C_SOURCE 200809L              // Включает POSIX.1-2008 стандарт
+
+#include <unistd.h>                          // write(), close()
+#include <fcntl.h>                           // open(), O_WRONLY, O_CREAT, O_TRUNC
+#include <stdlib.h>                          // strtoull()
+#include <string.h>                          // strcmp(), memcpy()
+#include <errno.h>                           // errno, EINTR (safe_write)
+#include <stdint.h>                          // uint64_t
+
+#include "../common.h"                       // safe_write()
+
+#define GEN_BUF (1 << 20)                    // Размер блока вывода
+#define TOKEN_MAX 64                         // Самое длинное число: знак, 19 цифр, точка, e-XX
+
+/* xorshift64* - быстрый детерминированный генератор (качества для данных хватает) */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* rng_below - случайное число в [0, n) */
+static inline unsigned rng_below(unsigned n) {
+    return (unsigned)(((rng_next() >> 32) * n) >> 32);
+}
+
+/* parse_size - "123", "64K", "8M", "20G" -> байты; 0 при ошибке */
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t v = strtoull(s, &end, 10);
+    if (end == s) return 0;
+    if (*end == 'K' || *end == 'k') v <<= 10, end++;
+    else if (*end == 'M' || *end == 'm') v <<= 20, end++;
+    else if (*end == 'G' || *end == 'g') v <<= 30, end++;
+    return *end == '\0' ? v : 0;
+}
+
+/*
+ * put_token - одно случайное число: [-]ddd.ddd или [-]d.ddde[-]XX
+ * Возвращает длину записанного.
+ */
+static size_t put_token(char *dst, unsigned digits, unsigned neg, unsigned exp) {
+    size_t len = 0;
+    int sci = rng_below(100) < exp;          // Экспоненциальная запись
+    unsigned point = sci ? 1 : rng_below(digits + 1); // Цифр до точки (0 - ".5" не бывает, будет "0.5")
+
+    if (rng_below(100) < neg) dst[len++] = '-';
+    if (point == 0) dst[len++] = '0';
+    for (unsigned i = 0; i < digits; i++) {
+        if (i == point) dst[len++] = '.';
+        dst[len++] = (char)('0' + (i == 0 && point > 0 ? 1 + rng_below(9) : rng_below(10)));
+    }
+    if (sci) {
+        unsigned e = rng_below(30);          // Порядок в пределах float
+        dst[len++] = 'e';
+        if (rng_below(2)) dst[len++] = '-';
+        if (e >= 10) dst[len++] = (char)('0' + e / 10);
+        dst[len++] = (char)('0' + e % 10);
+    }
+    return len;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t lines = 1000, size = 0;         // Объём: строк или байт (--size)
+    unsigned tokens = 8, digits = 6, neg = 25, exp = 5;
+    const char *out_path = NULL;
+    int out = STDOUT_FILENO;
+
+    for (int i = 1; i < argc; i++) {
+        int more = i + 1 < argc;
+        if (more && strcmp(argv[i], "--lines") == 0) lines = strtoull(argv[++i], NULL, 10);
+        else if (more && strcmp(argv[i], "--size") == 0) size = parse_size(argv[++i]);
+        else if (more && strcmp(argv[i], "--tokens") == 0) tokens = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (more && strcmp(argv[i], "--digits") == 0) digits = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (more && strcmp(argv[i], "--neg") == 0) neg = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (more && strcmp(argv[i], "--exp") == 0) exp = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (more && strcmp(argv[i], "--seed") == 0) rng_state ^= strtoull(argv[++i], NULL, 10) * 0x9E3779B97F4A7C15ULL;
+        else if (more && strcmp(argv[i], "-o") == 0) out_path = argv[++i];
+        else {
+            safe_write(STDERR_FILENO, "Usage: gen [--lines N | --size N[K|M|G]] [--tokens N] [--digits N] [--neg P] [--exp P] [--seed N] [-o FILE]\n", 108);
+            return 1;
+        }
+    }
+    if (tokens < 1 || digits < 1 || digits > 19 || (size == 0 && lines == 0)) {
+        safe_write(STDERR_FILENO, "gen: need tokens >= 1, 1 <= digits <= 19 and a non-zero size\n", 61);
+        return 1;
+    }
+    if (rng_state == 0) rng_state = 1;       // xorshift не выходит из нуля
+
+    if (out_path) {
+        out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            safe_write(STDERR_FILENO, "gen: open error\n", 16);
+            return 1;
+        }
+    }
+
+    static char buf[GEN_BUF + TOKEN_MAX];    // static - не на стеке
+    size_t pos = 0;
+    uint64_t written = 0, line = 0;
+
+    /* === ПОТОК СТРОК: блок заполняется целиком и сбрасывается === */
+    while (size ? written + pos < size : line < lines) {
+        for (unsigned t = 0; t < tokens; t++) {
+            pos += put_token(buf + pos, digits, neg, exp);
+            buf[pos++] = (t + 1 < tokens) ? ' ' : '\n';
+            if (pos >= GEN_BUF) {            // Строка может пересечь границу блока - это нормально
+                if (safe_write(out, buf, pos) < 0) {
+                    safe_write(STDERR_FILENO, "gen: write error\n", 17);
+                    return 1;
+                }
+                written += pos;
+                pos = 0;
+            }
+        }
+        line++;
+    }
+    if (pos > 0 && safe_write(out, buf, pos) < 0) {
+        safe_write(STDERR_FILENO, "gen: write error\n", 17);
+        return 1;
+    }
+
+    if (out != STDOUT_FILENO) close(out);
+    return 0;
+}
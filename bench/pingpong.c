@@ -0,0 +1,279 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Задержка одного обмена parent <-> child (pingpong)
+ *
+ * Меряет круг, из которого состоит каждый кусок в parent/child:
+ *   родитель: state = READY, sem_post(ready)  ->  дочерний просыпается,
+ *   дочерний: state = DONE,  sem_post(done)   ->  родитель просыпается.
+ * Используются те же RingShared/SharedData, sem_set_state()/sem_wait_state()
+ * (или ring_set()/ring_wait() с --ring) из common.h, но без данных в
+ * in[]/out[] - остаётся чистая стоимость передачи управления.
+ *
+ * Запуск: pingpong [--iters N] [--msync] [--ring] [--pin MODE | --cpus A,B]
+ *   --iters - число кругов (по умолчанию 1000000, плюс 1% на прогрев)
+ *   --msync - область в файле + msync(MS_SYNC) вокруг каждого сигнала,
+ *             как parent --shm file; без флага - memfd и барьеры памяти
+ *   --ring  - транспорт --ring (атомики + futex) вместо семафоров
+ *   --pin   - размещение процессов по топологии из /sys:
+ *             same   - оба на одном логическом CPU
+ *             smt    - соседние гиперпотоки одного ядра
+ *             core   - разные ядра одного сокета
+ *             socket - разные сокеты
+ *             none   - без привязки (по умолчанию)
+ *   --cpus  - явная пара CPU (родитель, дочерний)
+ *
+ * Вывод: гистограмма задержек (степени двойки) в stderr и одна
+ * JSON-строка с перцентилями в stdout - её можно дописывать в файл.
+ * Если на машине нет нужной пары CPU (например, один сокет), код
+ * возврата 2 - make latency такие комбинации пропускает.
+ *
+ * Это вспомогательный инструмент, а не часть лабораторной, поэтому
+ * здесь допустим printf().
+ * ============================================================================
+ */
+
+#define _GNU_SOURCE                          // sched_setaffinity(), CPU_SET, memfd_create()
+#define _POSIX_C_SOURCE 200809L              // Включает POSIX.1-2008 стандарт
+#define _XOPEN_SOURCE 700                    // Включает X/Open 7 расширения
+
+#include <unistd.h>                          // fork(), ftruncate(), close(), unlink()
+#include <fcntl.h>                           // open(), O_RDWR, O_CREAT
+#include <sys/mman.h>                        // mmap(), munmap(), memfd_create()
+#include <sys/wait.h>                        // waitpid()
+#include <sched.h>                           // sched_setaffinity(), sched_getaffinity(), cpu_set_t
+#include <semaphore.h>                       // sem_open(), sem_unlink(), sem_close()
+#include <stdio.h>                           // printf(), fprintf(), snprintf()
+#include <stdlib.h>                          // strtoul(), malloc(), qsort()
+#include <string.h>                          // strcmp(), memset()
+#include <stdint.h>                          // uint32_t, uint64_t
+#include <time.h>                            // clock_gettime(), CLOCK_MONOTONIC
+
+#include "../common.h"                       // RingShared, SharedData, sem_*_state(), ring_*()
+
+#define PP_FILE "/tmp/os_lab3_pingpong"      // --msync: файл области (удаляется сразу после mmap)
+#define PP_SEM_READY "/os_lab3_pp_ready"     // Семафоры (удаляются сразу после sem_open)
+#define PP_SEM_DONE "/os_lab3_pp_done"
+#define HIST_BUCKETS 40                      // Гистограмма: [2^i, 2^(i+1)) нс, до ~18 минут
+#define BAR_WIDTH 50                         // Длина самой длинной полосы гистограммы
+
+/* now_ns - монотонное время в наносекундах */
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* sysfs_int - целое из /sys/devices/system/cpu/cpuN/topology/<name>; -1 если нет */
+static int sysfs_int(int cpu, const char *name) {
+    char path[128], buf[32];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    return atoi(buf);
+}
+
+/*
+ * pick_cpus - пара CPU для --pin по топологии
+ *
+ * Первый доступный процессу CPU - родителю, дочернему - первый, который
+ * подходит под режим. Возвращает 0 или -1, если такой пары нет.
+ */
+static int pick_cpus(const char *mode, int *a, int *b) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return -1;
+
+    *a = -1;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &allowed)) continue;
+        if (*a < 0) {
+            *a = c;
+            if (strcmp(mode, "same") == 0) {
+                *b = c;
+                return 0;
+            }
+            continue;
+        }
+        int same_pkg = sysfs_int(c, "physical_package_id") == sysfs_int(*a, "physical_package_id");
+        int same_core = same_pkg && sysfs_int(c, "core_id") == sysfs_int(*a, "core_id");
+        if ((strcmp(mode, "smt") == 0 && same_core) ||
+            (strcmp(mode, "core") == 0 && same_pkg && !same_core) ||
+            (strcmp(mode, "socket") == 0 && !same_pkg)) {
+            *b = c;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* pin_self - привязать текущий процесс к одному CPU (cpu < 0 - не привязывать) */
+static void pin_self(int cpu) {
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) perror("sched_setaffinity");
+}
+
+static int cmp_u32(const void *x, const void *y) {
+    uint32_t a = *(const uint32_t *)x, b = *(const uint32_t *)y;
+    return (a > b) - (a < b);
+}
+
+/* percentile - nearest rank по отсортированному массиву */
+static uint32_t percentile(const uint32_t *sorted, size_t n, double p) {
+    size_t rank = (size_t)(p / 100.0 * (double)n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long iters = 1000000;
+    int use_msync = 0, ring = 0;
+    const char *pin = "none";
+    int cpu_parent = -1, cpu_child = -1;
+
+    for (int i = 1; i < argc; i++) {
+        int more = i + 1 < argc;
+        if (more && strcmp(argv[i], "--iters") == 0) iters = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--msync") == 0) use_msync = 1;
+        else if (strcmp(argv[i], "--ring") == 0) ring = 1;
+        else if (more && strcmp(argv[i], "--pin") == 0) pin = argv[++i];
+        else if (more && strcmp(argv[i], "--cpus") == 0 &&
+                 sscanf(argv[i + 1], "%d,%d", &cpu_parent, &cpu_child) == 2) {
+            pin = "cpus";
+            i++;
+        } else {
+            fprintf(stderr, "Usage: pingpong [--iters N] [--msync] [--ring] [--pin same|smt|core|socket|none | --cpus A,B]\n");
+            return 1;
+        }
+    }
+    if (iters == 0) iters = 1;
+    if (strcmp(pin, "none") != 0 && strcmp(pin, "cpus") != 0 && pick_cpus(pin, &cpu_parent, &cpu_child) < 0) {
+        fprintf(stderr, "pingpong: no CPU pair for --pin %s on this machine\n", pin);
+        return 2;
+    }
+    if (ring && use_msync) {
+        fprintf(stderr, "pingpong: --ring never calls msync, --msync ignored\n");
+        use_msync = 0;
+    }
+
+    /* === ОБЛАСТЬ: как у parent (SHM_BUFFERS слотов), memfd или файл === */
+    int nslots = ring ? RING_SLOTS : SHM_BUFFERS;
+    size_t map_size = SHM_REGION_SIZE(nslots, SHM_CAP_DEFAULT); // msync сбрасывает столько же, сколько у parent
+    int fd = use_msync ? open(PP_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600) : memfd_create(MEMFD_NAME, 0);
+    if (fd < 0 || ftruncate(fd, (off_t)map_size) < 0) {
+        perror("pingpong: region");
+        return 1;
+    }
+    RingShared *rs = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (use_msync) unlink(PP_FILE);          // Отображение живёт и без имени
+    if (rs == MAP_FAILED) {
+        perror("pingpong: mmap");
+        return 1;
+    }
+    shm_init(rs, nslots, SHM_CAP_DEFAULT);
+    SharedData *slot = &rs->slot[0];
+
+    sem_t *sem_ready = SEM_FAILED, *sem_done = SEM_FAILED;
+    if (!ring) {                             // fork() без exec: открытые семафоры наследуются
+        sem_unlink(PP_SEM_READY);
+        sem_unlink(PP_SEM_DONE);
+        sem_ready = sem_open(PP_SEM_READY, O_CREAT | O_EXCL, 0600, 0);
+        sem_done = sem_open(PP_SEM_DONE, O_CREAT | O_EXCL, 0600, 0);
+        sem_unlink(PP_SEM_READY);
+        sem_unlink(PP_SEM_DONE);
+        if (sem_ready == SEM_FAILED || sem_done == SEM_FAILED) {
+            perror("pingpong: sem_open");
+            return 1;
+        }
+    }
+
+    unsigned long warmup = iters / 100 + 1;  // Прогрев: кэши, страницы, частота CPU
+    uint32_t *lat = malloc(iters * sizeof(*lat));
+    if (!lat) {
+        perror("pingpong: malloc");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("pingpong: fork");
+        return 1;
+    }
+
+    if (pid == 0) {
+        /* === ДОЧЕРНИЙ: READY -> DONE, пока не придёт SHM_QUIT === */
+        pin_self(cpu_child);
+        for (;;) {
+            if (ring) ring_wait(&slot->state, SLOT_READY, SLOT_READY, &rs->child_sleeping);
+            else sem_wait_state(&slot->state, SLOT_READY, SLOT_READY, sem_ready, rs, map_size, use_msync);
+            if (slot->flags & SHM_QUIT) _exit(0);
+            if (ring) ring_set(&slot->state, SLOT_DONE, &rs->parent_sleeping);
+            else sem_set_state(&slot->state, SLOT_DONE, sem_done, rs, map_size, use_msync);
+        }
+    }
+
+    /* === РОДИТЕЛЬ: круг = READY туда, DONE обратно === */
+    pin_self(cpu_parent);
+    for (unsigned long i = 0; i < warmup + iters; i++) {
+        uint64_t t0 = now_ns();
+        if (ring) {
+            ring_set(&slot->state, SLOT_READY, &rs->child_sleeping);
+            ring_wait(&slot->state, SLOT_DONE, SLOT_DONE, &rs->parent_sleeping);
+        } else {
+            sem_set_state(&slot->state, SLOT_READY, sem_ready, rs, map_size, use_msync);
+            sem_wait_state(&slot->state, SLOT_DONE, SLOT_DONE, sem_done, rs, map_size, use_msync);
+        }
+        uint64_t dt = now_ns() - t0;
+        if (i >= warmup) lat[i - warmup] = dt > UINT32_MAX ? UINT32_MAX : (uint32_t)dt;
+    }
+
+    slot->flags = SHM_QUIT;                  // Остановить дочерний
+    if (ring) ring_set(&slot->state, SLOT_READY, &rs->child_sleeping);
+    else sem_set_state(&slot->state, SLOT_READY, sem_ready, rs, map_size, use_msync);
+    waitpid(pid, NULL, 0);
+
+    /* === ГИСТОГРАММА И ПЕРЦЕНТИЛИ === */
+    unsigned long hist[HIST_BUCKETS] = {0}, top = 0;
+    uint64_t total = 0;
+    for (unsigned long i = 0; i < iters; i++) {
+        int b = lat[i] ? 31 - __builtin_clz(lat[i]) : 0;
+        hist[b]++;
+        total += lat[i];
+    }
+    for (int b = 0; b < HIST_BUCKETS; b++) if (hist[b] > top) top = hist[b];
+
+    const char *transport = ring ? "ring" : "sem";
+    fprintf(stderr, "pingpong: %s, msync %s, pin %s (parent cpu %d, child cpu %d), %lu round trips\n",
+            transport, use_msync ? "on" : "off", pin, cpu_parent, cpu_child, iters);
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        if (!hist[b]) continue;
+        char bar[BAR_WIDTH + 1];
+        int w = (int)((hist[b] * BAR_WIDTH + top - 1) / top);
+        memset(bar, '#', (size_t)w);
+        bar[w] = '\0';
+        fprintf(stderr, "  [%10lu, %10lu) ns %10lu %6.2f%% %s\n", 1UL << b, 2UL << b, hist[b],
+                100.0 * (double)hist[b] / (double)iters, bar);
+    }
+
+    qsort(lat, iters, sizeof(*lat), cmp_u32);
+    printf("{\"transport\":\"%s\",\"msync\":%d,\"pin\":\"%s\",\"cpu_parent\":%d,\"cpu_child\":%d,\"iters\":%lu,"
+           "\"min_ns\":%u,\"p50_ns\":%u,\"p90_ns\":%u,\"p99_ns\":%u,\"p999_ns\":%u,\"max_ns\":%u,\"mean_ns\":%.1f}\n",
+           transport, use_msync, pin, cpu_parent, cpu_child, iters,
+           lat[0], percentile(lat, iters, 50), percentile(lat, iters, 90), percentile(lat, iters, 99),
+           percentile(lat, iters, 99.9), lat[iters - 1], (double)total / (double)iters);
+
+    free(lat);
+    if (!ring) {
+        sem_close(sem_ready);
+        sem_close(sem_done);
+    }
+    munmap(rs, map_size);
+    return 0;
+}
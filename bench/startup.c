@@ -0,0 +1,214 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Стоимость запуска parent + child (startup)
+ *
+ * Прогоняет build/parent с заданными опциями на крошечном входе (одна
+ * строка) - почти всё время такого прогона уходит на создание и удаление
+ * IPC-объектов, fork/exec и отображения, - и печатает:
+ *   - время прогона целиком (p50/min по --runs прогонам, без трассировки);
+ *   - число системных вызовов всего дерева процессов (один прогон под
+ *     ptrace): всего, у родителя, у дочерних, и отдельно те, из которых
+ *     складывается настройка обмена (openat, mmap, munmap, ftruncate,
+ *     unlink, link, close, futex).
+ *
+ * Запуск: startup [--runs N] [-- опции parent...]
+ *   например: startup --runs 200 -- -j 8 --sem pshared
+ *
+ * Вывод - одна JSON-строка в stdout, как у pingpong/bench.sh.
+ * Нужен ptrace (в контейнере без CAP_SYS_PTRACE/при seccomp число вызовов
+ * будет -1, время всё равно измерится).
+ *
+ * Это вспомогательный инструмент, а не часть лабораторной, поэтому
+ * здесь допустим printf().
+ * ============================================================================
+ */
+
+#define _GNU_SOURCE                          // PTRACE_GET_SYSCALL_INFO, __WALL
+#define _POSIX_C_SOURCE 200809L              // Включает POSIX.1-2008 стандарт
+#define _XOPEN_SOURCE 700                    // Включает X/Open 7 расширения
+
+#include <unistd.h>                          // fork(), execv(), pipe(), dup2()
+#include <fcntl.h>                           // open(), O_WRONLY
+#include <signal.h>                          // raise(), SIGSTOP, SIGTRAP
+#include <sys/ptrace.h>                      // ptrace(), PTRACE_*
+#include <sys/syscall.h>                     // SYS_* - номера вызовов
+#include <sys/wait.h>                        // waitpid(), __WALL
+#include <stdio.h>                           // printf(), fprintf()
+#include <stdlib.h>                          // strtoul(), malloc(), qsort()
+#include <string.h>                          // strcmp()
+#include <stdint.h>                          // uint64_t
+#include <time.h>                            // clock_gettime()
+
+#define ST_INPUT "/tmp/os_lab3_startup.txt"  // Вход: одна строка (удаляется в конце)
+#define MAX_ARGS 64                          // Опций parent не больше
+#define MAX_NR 1024                          // Номера системных вызовов меньше
+
+/* Вызовы, из которых складывается настройка обмена (есть не на всех архитектурах) */
+static const struct {
+    long nr;
+    const char *name;
+} watch[] = {
+    {SYS_openat, "openat"},
+    {SYS_mmap, "mmap"},
+    {SYS_munmap, "munmap"},
+    {SYS_ftruncate, "ftruncate"},
+#ifdef SYS_unlink
+    {SYS_unlink, "unlink"},
+#endif
+    {SYS_unlinkat, "unlinkat"},
+#ifdef SYS_link
+    {SYS_link, "link"},
+#endif
+    {SYS_linkat, "linkat"},
+    {SYS_close, "close"},
+    {SYS_futex, "futex"},
+};
+
+/* now_ns - монотонное время в наносекундах */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * spawn - запустить parent: stdin - имя входа, stdout - /dev/null
+ *
+ * traced = 1: дочерний сам просит трассировку и останавливается до execv.
+ */
+static pid_t spawn(char **args, int traced) {
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[1]);
+        dup2(fds[0], STDIN_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            raise(SIGSTOP);                  // Ждём, пока трассировщик выставит опции
+        }
+        execv(args[0], args);
+        _exit(127);
+    }
+    close(fds[0]);
+    if (pid > 0 && write(fds[1], ST_INPUT "\n", sizeof(ST_INPUT)) != (ssize_t)sizeof(ST_INPUT)) pid = -1;
+    close(fds[1]);
+    return pid;
+}
+
+/*
+ * count_syscalls - один прогон под ptrace, входы в вызовы всего дерева процессов
+ *
+ * PTRACE_O_TRACEFORK/CLONE: дочерние и их потоки трассируются автоматически.
+ * root[] - вызовы самого parent, all[] - всего дерева. Возвращает 0 или -1.
+ */
+static int count_syscalls(char **args, unsigned long *root, unsigned long *all) {
+    pid_t pid = spawn(args, 1);
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) return -1;
+    long opts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |
+                PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)opts) < 0 || ptrace(PTRACE_SYSCALL, pid, NULL, NULL) < 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    for (;;) {
+        pid_t t = waitpid(-1, &status, __WALL);
+        if (t < 0) break;                    // Все трассируемые завершились
+        if (!WIFSTOPPED(status)) continue;   // Завершился один из процессов/потоков
+
+        int sig = WSTOPSIG(status), inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {       // Вход или выход из вызова
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, t, (void *)sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_ENTRY && info.entry.nr < MAX_NR) {
+                all[info.entry.nr]++;
+                if (t == pid) root[info.entry.nr]++;
+            }
+        } else if (sig != SIGTRAP && sig != SIGSTOP) {
+            inject = sig;                    // Настоящий сигнал - доставить (SIGSTOP - старт нового потомка)
+        }
+        ptrace(PTRACE_SYSCALL, t, NULL, (void *)(long)inject);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long runs = 100;
+    char *args[MAX_ARGS + 2];
+    int nargs = 0;
+
+    args[nargs++] = "./build/parent";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc && nargs <= MAX_ARGS; i++) args[nargs++] = argv[i];
+        } else {
+            fprintf(stderr, "Usage: startup [--runs N] [-- parent options...]\n");
+            return 1;
+        }
+    }
+    args[nargs] = NULL;
+    if (runs == 0) runs = 1;
+
+    FILE *f = fopen(ST_INPUT, "w");
+    if (!f || fputs("1.5 2.5\n", f) < 0 || fclose(f) != 0) {
+        perror("startup: " ST_INPUT);
+        return 1;
+    }
+
+    /* === ВРЕМЯ: runs прогонов без трассировки === */
+    uint64_t *t = malloc(runs * sizeof(*t));
+    if (!t) {
+        perror("startup: malloc");
+        return 1;
+    }
+    for (unsigned long r = 0; r < runs; r++) {
+        uint64_t t0 = now_ns();
+        pid_t pid = spawn(args, 0);
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "startup: parent failed\n");
+            unlink(ST_INPUT);
+            return 1;
+        }
+        t[r] = now_ns() - t0;
+    }
+    qsort(t, runs, sizeof(*t), cmp_u64);
+
+    /* === СИСТЕМНЫЕ ВЫЗОВЫ: один прогон под ptrace === */
+    static unsigned long root[MAX_NR], all[MAX_NR];
+    int traced = count_syscalls(args, root, all) == 0;
+    unlink(ST_INPUT);
+
+    unsigned long total = 0, in_root = 0;
+    for (int i = 0; i < MAX_NR; i++) {
+        total += all[i];
+        in_root += root[i];
+    }
+
+    printf("{\"args\":\"");
+    for (int i = 1; i < nargs; i++) printf("%s%s", i > 1 ? " " : "", args[i]);
+    printf("\",\"runs\":%lu,\"p50_us\":%.1f,\"min_us\":%.1f,", runs, t[(runs - 1) / 2] / 1e3, t[0] / 1e3);
+    if (traced) {
+        printf("\"syscalls\":%lu,\"parent\":%lu,\"children\":%lu", total, in_root, total - in_root);
+        for (size_t i = 0; i < sizeof(watch) / sizeof(watch[0]); i++) {
+            if (all[watch[i].nr]) printf(",\"%s\":%lu", watch[i].name, all[watch[i].nr]);
+        }
+    } else {
+        printf("\"syscalls\":-1");
+    }
+    printf("}\n");
+    free(t);
+    return 0;
+}
@@ -2,10 +2,17 @@
  * ============================================================================
  * Лабораторная работа №3 - Дочерний процесс (child)
  * 
- *
+ * Собирается дважды:
+ * - build/child - отдельная программа, её запускает parent (posix_spawn);
+ * - build/child_embed.o (-DCHILD_EMBED) - тот же код, main() называется
+ *   child_main() и вызывается в потоке родителя (parent --inproc). Протокол
+ *   обмена тот же (SharedData, семафоры/кольцо), меняется только то, что
+ *   "дочерний" живёт в адресном пространстве родителя: состояние, своё у
+ *   каждого дочернего, - CHILD_LOCAL (у каждого потока своё).
  * ============================================================================
  */
 
+#define _GNU_SOURCE                          // syscall() для futex в режиме --ring
 #define _POSIX_C_SOURCE 200809L              // Включает POSIX.1-2008 стандарт (семафоры, mmap)
 #define _XOPEN_SOURCE 700                    // Включает X/Open 7 расширения
 
@@ -13,190 +20,1633 @@
 #include <fcntl.h>                           // open(), O_RDWR
 #include <sys/mman.h>                        // mmap(), munmap(), msync()
 #include <sys/types.h>                       // size_t, ssize_t
+#include <sys/stat.h>                        // fstat(), struct stat (размер входного файла)
 #include <semaphore.h>                       // sem_t, sem_open(), sem_close(), sem_wait(), sem_post()
-#include <stdlib.h>                          // strtof() - преобразование строки в float, _exit()
-#include <string.h>                          // Не используем напрямую, но нужен для некоторых деклараций
+#include <stdlib.h>                          // strtof() - преобразование строки в float, atoi(), _exit()
+#include <string.h>                          // strcmp(), strncmp(), memcpy()
+#include <signal.h>                          // signal(), SIGINT, SIG_IGN (режим --server)
+#include <sys/prctl.h>                       // prctl(PR_SET_PDEATHSIG) - завершиться вместе с родителем
 #include <errno.h>                           // errno, EINTR, ERANGE
+#include <stdint.h>                          // uint64_t
+#include <float.h>                           // FLT_MIN, FLT_MAX, DBL_MAX
+#include <math.h>                            // INFINITY, NAN (--agg)
+#include <pthread.h>                         // pthread_create(), pthread_barrier_t (--threads)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>                       // SSE2/AVX2 intrinsics (_mm_cmpeq_epi8, _mm256_movemask_epi8, ...)
+#endif
+
+#include "common.h"                          // SharedData, RingShared, имена семафоров, safe_write()
+
+#ifdef CHILD_EMBED
+#define CHILD_LOCAL _Thread_local            // parent --inproc: несколько "дочерних" в одном процессе
+#define main child_main                      // Точка входа для потока родителя (объявлена в parent.c)
+#else
+#define CHILD_LOCAL
+#endif
+
+/* ============================================================================
+ * ФОРМАТИРОВАНИЕ ЧИСЕЛ: корректное округление без printf
+ *
+ * Прежний вариант приводил сумму к int (всё, что больше 2^31, - мусор),
+ * считал дробную часть в float и обрезал её до 99 вместо переноса в
+ * целую часть (9.999 -> "9.99"). Теперь:
+ * - режим по умолчанию - ровно fmt_precision знаков после точки, как
+ *   printf("%.Nf"): точное двоичное значение округляется к ближайшему,
+ *   при равенстве - к чётному. x = m * 2^e, поэтому дробь после
+ *   умножения на 10^N - целое (m_frac * 10^N) / 2^k: хватает 64/128-битной
+ *   арифметики; длинная арифметика (Big) нужна только при |x| >= 2^127;
+ * - --precision shortest - кратчайшая запись, которая читается обратно
+ *   (strtof) в тот же самый float;
+ * - цифры пишутся парами из таблицы "00".."99" сразу на своё место, с
+ *   конца числа (длина известна заранее) - без временного массива.
+ * ============================================================================ */
+
+#define FMT_SHORTEST (-1)                    // fmt_precision: кратчайшая запись
+#define BIG_LIMBS 40                         // Big: 40 * 32 = 1280 бит (m * 10^341 для денормалов double)
+
+static CHILD_LOCAL int fmt_precision = 2;    // Знаков после точки (--precision), по умолчанию как раньше
+static CHILD_LOCAL int dec_mode = 0;         // --decimal: суммы - целые в единицах 10^-fmt_precision
+static CHILD_LOCAL unsigned agg_mask = AGG_SUM; // --agg: что выводить для строки (AGG_*)
+static CHILD_LOCAL int agg_columns = 0;      // --columns: значения через '\t' без подписей
+static CHILD_LOCAL size_t result_max = RESULT_MAX; // Наибольшая строка результата при этих --agg
+static CHILD_LOCAL int server_mode = 0;      // --server: ошибка во входе - ответ родителю, а не выход
+static CHILD_LOCAL const char *_Atomic input_error; // --server: первая ошибка разбора в текущем файле (NULL - нет)
 
-#define MMAP_SIZE 8192                       
-#define SEM_READY "/os_lab3_sem_ready"       
-#define SEM_DONE "/os_lab3_sem_done"         
+static const char digit_pairs[201] =         // Пары цифр: digit_pairs[2*i], digit_pairs[2*i+1] = i (00..99)
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-/* СТРУКТУРА ДОЛЖНА БЫТЬ ИДЕНТИЧНА parent.c! */
+static const uint64_t pow10_u64[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* count_digits - количество десятичных цифр v (1 для нуля) */
+static inline size_t count_digits(uint64_t v) {
+    v |= 1;                                  // Ноль - одна цифра, как единица
+    size_t t = (size_t)((64 - __builtin_clzll(v)) * 1233) >> 12; // ~ число бит * log10(2)
+    return t + 1 - (v < pow10_u64[t]);       // Без цикла: ошибка оценки не больше единицы
+}
+
+/* put_digits - ровно n цифр v (с ведущими нулями), парами с конца; end - позиция ЗА последней цифрой */
+static inline void put_digits(char *end, uint64_t v, size_t n) {
+    if (v <= UINT32_MAX) {                   // Обычный случай: 32-битное деление дешевле
+        uint32_t w = (uint32_t)v;
+        while (n >= 2) {
+            end -= 2;
+            memcpy(end, digit_pairs + 2 * (w % 100), 2);
+            w /= 100;
+            n -= 2;
+        }
+        if (n) *--end = (char)('0' + w % 10);
+        return;
+    }
+    while (n >= 2) {
+        end -= 2;
+        memcpy(end, digit_pairs + 2 * (v % 100), 2);
+        v /= 100;
+        n -= 2;
+    }
+    if (n) *--end = (char)('0' + v % 10);
+}
+
+/* put_u64 - число без ведущих нулей, возвращает длину */
+static inline size_t put_u64(char *dst, uint64_t v) {
+    size_t n = count_digits(v);
+    put_digits(dst + n, v, n);
+    return n;
+}
+
+/* put_u128 - то же для 128-битного числа (старшая часть < 10^19 при v < 2^127) */
+static size_t put_u128(char *dst, unsigned __int128 v) {
+    if (v <= UINT64_MAX) return put_u64(dst, (uint64_t)v);
+    size_t n = put_u64(dst, (uint64_t)(v / pow10_u64[19]));
+    put_digits(dst + n + 19, (uint64_t)(v % pow10_u64[19]), 19);
+    return n + 19;
+}
+
+/*
+ * Big - неотрицательное целое произвольной длины (младшие слова первыми)
+ *
+ * Нужно для редких случаев: |x| >= 2^127 (только double) и поиска
+ * кратчайшей записи, где x масштабируется на 10^s с любым s.
+ */
 typedef struct {
-    size_t data_size;                        // Размер данных (8 байт на x64)
-    char data[MMAP_SIZE - sizeof(size_t)];  
-} SharedData;
-
-/* safe_write - аналогична parent.c */
-static ssize_t safe_write(int fd, const void *buf, size_t count) {
-    const char *p = buf;                     // Указатель на текущую позицию
-    size_t left = count;                     // Оставшиеся байты
-    
-    while (left > 0) {                       // Цикл до полной записи
-        ssize_t written = write(fd, p, left); // Попытка записи
-        
-        if (written < 0) {                   // Ошибка
-            if (errno == EINTR) continue;    // Прерван сигналом - повторить
-            return -1;                       // Другая ошибка
+    uint32_t w[BIG_LIMBS];                   // Слова по 32 бита
+    int n;                                   // Значимых слов (0 = ноль)
+} Big;
+
+static void big_set_u64(Big *b, uint64_t v) {
+    b->w[0] = (uint32_t)v;
+    b->w[1] = (uint32_t)(v >> 32);
+    b->n = b->w[1] ? 2 : (b->w[0] ? 1 : 0);
+}
+
+static void big_mul_small(Big *b, uint32_t f) {
+    uint64_t carry = 0;
+    for (int i = 0; i < b->n; i++) {
+        uint64_t t = (uint64_t)b->w[i] * f + carry;
+        b->w[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry) b->w[b->n++] = (uint32_t)carry;
+}
+
+static void big_add_small(Big *b, uint32_t a) {
+    for (int i = 0; a && i < b->n; i++) {
+        uint64_t t = (uint64_t)b->w[i] + a;
+        b->w[i] = (uint32_t)t;
+        a = (uint32_t)(t >> 32);
+    }
+    if (a) b->w[b->n++] = a;
+}
+
+static void big_shl(Big *b, int bits) {
+    int words = bits / 32, sh = bits % 32;
+    if (b->n == 0) return;
+    b->w[b->n] = 0;
+    for (int i = b->n; i >= 0; i--) {        // Сначала сдвиг внутри слов (сверху вниз)
+        uint32_t lo = (sh && i > 0) ? b->w[i - 1] >> (32 - sh) : 0;
+        b->w[i] = (sh ? b->w[i] << sh : b->w[i]) | lo;
+    }
+    int n = b->n + 1;
+    while (n > 0 && b->w[n - 1] == 0) n--;
+    for (int i = n - 1; i >= 0; i--) b->w[i + words] = b->w[i]; // Затем целыми словами
+    for (int i = 0; i < words; i++) b->w[i] = 0;
+    b->n = n + words;
+}
+
+/* big_any_below - есть ли единичные биты ниже позиции bits */
+static int big_any_below(const Big *b, int bits) {
+    int words = bits / 32, sh = bits % 32;
+    for (int i = 0; i < words && i < b->n; i++) if (b->w[i]) return 1;
+    return sh && words < b->n && (b->w[words] & ((1u << sh) - 1));
+}
+
+static int big_bit(const Big *b, int bit) {
+    return bit / 32 < b->n && ((b->w[bit / 32] >> (bit % 32)) & 1);
+}
+
+static void big_shr(Big *b, int bits) {
+    int words = bits / 32, sh = bits % 32;
+    if (words >= b->n) {
+        b->n = 0;
+        return;
+    }
+    for (int i = 0; i + words < b->n; i++) {
+        uint32_t hi = (sh && i + words + 1 < b->n) ? b->w[i + words + 1] << (32 - sh) : 0;
+        b->w[i] = (b->w[i + words] >> sh) | hi;
+    }
+    b->n -= words;
+    while (b->n > 0 && b->w[b->n - 1] == 0) b->n--;
+}
+
+/* big_divmod_small - b /= d, возвращает остаток */
+static uint32_t big_divmod_small(Big *b, uint32_t d) {
+    uint64_t rem = 0;
+    for (int i = b->n - 1; i >= 0; i--) {
+        uint64_t cur = (rem << 32) | b->w[i];
+        b->w[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    while (b->n > 0 && b->w[b->n - 1] == 0) b->n--;
+    return (uint32_t)rem;
+}
+
+/*
+ * round_scaled - b = round(m * 2^e * 10^s), к ближайшему, при равенстве к чётному
+ *
+ * Точные множители (2^e при e > 0, 10^s при s > 0) применяются сразу,
+ * делители (2^k, 10^t) - делением с учётом всех отброшенных битов
+ * (sticky): половину от "чуть больше половины" отличает любой ненулевой
+ * остаток на любом шаге.
+ */
+static void round_scaled(Big *b, uint64_t m, int e, int s) {
+    int k = e < 0 ? -e : 0;                  // Делитель 2^k
+    int t = s < 0 ? -s : 0;                  // Делитель 10^t
+    int up;
+
+    big_set_u64(b, m);
+    if (e > 0) big_shl(b, e);
+    for (int r = s; r > 0; r -= 9) big_mul_small(b, (uint32_t)pow10_u64[r > 9 ? 9 : r]);
+
+    if (t == 0) {                            // Только сдвиг: смотрим бит k-1 и всё, что ниже
+        int half = k > 0 && big_bit(b, k - 1);
+        int below = k > 1 && big_any_below(b, k - 1);
+        big_shr(b, k);
+        up = half && (below || (b->n > 0 && (b->w[0] & 1)));
+    } else {
+        int sticky = k > 0 && big_any_below(b, k);
+        big_shr(b, k);
+        for (int r = t - 1; r > 0; r -= 9) { // Все цифры, кроме последней отбрасываемой
+            if (big_divmod_small(b, (uint32_t)pow10_u64[r > 9 ? 9 : r])) sticky = 1;
         }
-        
-        p += written;                        // Сдвиг указателя
-        left -= written;                     // Уменьшение счётчика
+        uint32_t d = big_divmod_small(b, 10); // Последняя отбрасываемая цифра решает
+        up = d > 5 || (d == 5 && (sticky || (b->n > 0 && (b->w[0] & 1))));
     }
-    
-    return count;                            // Успех
+    if (up) big_add_small(b, 1);
+}
+
+/* big_to_dec - десятичная запись b не короче min_digits (ведущие нули), возвращает длину */
+static size_t big_to_dec(char *dst, Big *b, size_t min_digits) {
+    uint32_t groups[BIG_LIMBS * 10 / 9 + 2]; // Группы по 9 цифр, младшие первыми
+    int ng = 0;
+
+    while (b->n > 0) groups[ng++] = big_divmod_small(b, 1000000000u);
+
+    size_t len = 0, total = (size_t)ng * 9;
+    while (total < min_digits) {             // Ведущие нули до min_digits
+        dst[len++] = '0';
+        total++;
+    }
+    if (ng == 0) return len;
+
+    len += (len == 0) ? put_u64(dst, groups[ng - 1]) : (put_digits(dst + len + 9, groups[ng - 1], 9), 9);
+    for (int i = ng - 2; i >= 0; i--) {
+        put_digits(dst + len + 9, groups[i], 9);
+        len += 9;
+    }
+    return len;
+}
+
+/* decode_double - x = m * 2^e (x конечное, > 0) */
+static void decode_double(double x, uint64_t *m, int *e) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int be = (int)((bits >> 52) & 0x7FF);
+    *m = bits & ((1ULL << 52) - 1);
+    if (be == 0) {                           // Денормал: нет скрытой единицы
+        *e = -1074;
+    } else {
+        *m |= 1ULL << 52;
+        *e = be - 1075;
+    }
+}
+
+/* fmt_special - inf/nan; возвращает длину или 0, если x конечное */
+static inline size_t fmt_special(char *dst, double x) {
+    if (x != x) {
+        memcpy(dst, "nan", 3);
+        return 3;
+    }
+    if (x > DBL_MAX || x < -DBL_MAX) {
+        size_t len = 0;
+        if (x < 0) dst[len++] = '-';
+        memcpy(dst + len, "inf", 3);
+        return len + 3;
+    }
+    return 0;
+}
+
+/* put_fixed - "whole.frac" с ровно prec цифрами дроби (ведущие нули дроби сохраняются) */
+static inline size_t put_fixed(char *dst, uint64_t whole, uint64_t frac, int prec) {
+    size_t len = put_u64(dst, whole);
+    if (prec > 0) {
+        dst[len++] = '.';
+        put_digits(dst + len + prec, frac, (size_t)prec);
+        len += (size_t)prec;
+    }
+    return len;
+}
+
+/*
+ * fmt_fixed_wide - медленная часть fmt_fixed: x = m * 2^e, которое не
+ * помещается в 64 бита. Дробь (m_frac * 10^prec) / 2^k - в 128-битной
+ * арифметике (m < 2^53, 10^17 < 2^57); при k > 113 число меньше половины
+ * последнего разряда - это ноль. Целые >= 2^127 (только double) - через Big.
+ * Вынесена отдельно, чтобы не раздувать стек и регистры быстрого пути.
+ */
+static __attribute__((noinline)) size_t fmt_fixed_wide(char *dst, uint64_t m, int e, int prec) {
+    uint64_t p10 = pow10_u64[prec];
+    size_t len;
+
+    if (e < 0) {
+        int k = -e;
+        uint64_t whole = 0, frac = 0;        // Целая часть и prec цифр дроби
+
+        if (k <= 113) {
+            uint64_t fm = (k < 64) ? (m & ((1ULL << k) - 1)) : m; // Дробные биты мантиссы
+            if (k < 64) whole = m >> k;
+            unsigned __int128 scaled = (unsigned __int128)fm * p10;
+            unsigned __int128 half = (unsigned __int128)1 << (k - 1);
+            unsigned __int128 rem = scaled & ((half << 1) - 1);
+            frac = (uint64_t)(scaled >> k);
+            uint64_t last = prec ? frac : whole; // Последний выводимый разряд (для "к чётному")
+            if (rem > half || (rem == half && (last & 1))) frac++; // Половина - к чётному
+            if (frac == p10) {               // 9.999 -> 10.00: перенос в целую часть
+                frac = 0;
+                whole++;
+            }
+        }
+        return put_fixed(dst, whole, frac, prec);
+    }
+
+    if (e <= 74) {                           // Целое < 2^127: хватает 128 бит
+        len = put_u128(dst, (unsigned __int128)m << e);
+    } else {                                 // Только double >= 2^127
+        Big b;
+        round_scaled(&b, m, e, 0);
+        len = big_to_dec(dst, &b, 1);
+    }
+    if (prec > 0) {
+        dst[len++] = '.';
+        memset(dst + len, '0', (size_t)prec);
+        len += (size_t)prec;
+    }
+    return len;
+}
+
+/*
+ * fmt_fixed - x с prec знаками после точки (prec <= FMT_PREC_MAX), без '\0'
+ *
+ * Быстрый путь: целая часть = m >> k, дробь (m_frac * 10^prec) делится
+ * на 2^k. У суммы-float мантисса после отбрасывания хвостовых нулей не
+ * длиннее 24 бит, и произведение обычно влезает в 64 бита; всё
+ * остальное - в fmt_fixed_wide().
+ */
+static size_t fmt_fixed(char *dst, double x, int prec) {
+    size_t len = fmt_special(dst, x);
+    if (len) return len;
+
+    if (x < 0) {
+        dst[len++] = '-';
+        x = -x;
+    }
+
+    uint64_t m;
+    int e;
+    decode_double(x, &m, &e);
+    if (m) {                                 // Без хвостовых нулей: у float мантисса сжимается до 24 бит
+        int tz = __builtin_ctzll(m);
+        m >>= tz;
+        e += tz;
+    }
+
+    uint64_t scaled, p10 = pow10_u64[prec];
+    if (e < 0 && e > -64 && !__builtin_mul_overflow(m & ((1ULL << -e) - 1), p10, &scaled)) {
+        int k = -e;
+        uint64_t half = 1ULL << (k - 1);
+        uint64_t rem = scaled & ((half << 1) - 1);
+        uint64_t whole = m >> k;
+        uint64_t frac = scaled >> k;
+        uint64_t last = prec ? frac : whole; // Последний выводимый разряд (для "к чётному")
+        if (rem > half || (rem == half && (last & 1))) frac++; // Половина - к чётному
+        if (frac == p10) {                   // 9.999 -> 10.00: перенос в целую часть
+            frac = 0;
+            whole++;
+        }
+        return len + put_fixed(dst + len, whole, frac, prec);
+    }
+    return len + fmt_fixed_wide(dst + len, m, e, prec);
+}
+
+/*
+ * fmt_shortest - кратчайшая запись float, которая читается обратно в тот же float
+ *
+ * Для p = 1, 2, ... 9 значащих цифр: корректно округлённые p цифр
+ * (round_scaled), проверка обратным разбором strtof(). Для float 9 цифр
+ * достаточно всегда. Позиционная запись при порядке -7 < E < 21,
+ * иначе экспоненциальная (1.5e+30).
+ */
+static size_t fmt_shortest(char *dst, float xf) {
+    double x = xf;                           // float -> double точно
+    size_t len = fmt_special(dst, x);
+    if (len) return len;
+
+    if (x < 0) {
+        dst[len++] = '-';
+        x = -x;
+    }
+    if (x == 0) {
+        dst[len++] = '0';
+        return len;
+    }
+
+    uint64_t m;
+    int e;
+    decode_double(x, &m, &e);
+    int bitlen = 64 - __builtin_clzll(m);
+    int l2 = e + bitlen - 1;                 // x в [2^l2, 2^(l2+1))
+    int E0 = (l2 >= 0) ? (l2 * 78913) >> 18 : -((-l2 * 78913 + (1 << 18) - 1) >> 18); // ~floor(l2 * log10(2))
+
+    uint64_t q = 0;
+    int p, E = E0;
+    for (p = 1; p <= 9; p++) {
+        E = E0;                              // Порядок зависит от p: 9.8 -> "1e1" при p = 1, но "98e-1" при p = 2
+        for (;;) {                           // q = p цифр: 10^(p-1) <= q < 10^p
+            Big b;
+            round_scaled(&b, m, e, p - 1 - E);
+            q = (b.n > 1) ? ((uint64_t)b.w[1] << 32 | b.w[0]) : (b.n ? b.w[0] : 0);
+            if (b.n > 2 || q >= pow10_u64[p]) E++;
+            else if (q < pow10_u64[p - 1]) E--;
+            else break;
+        }
+
+        char tmp[32];                        // "ddddddddde-123" для проверки
+        size_t tl = put_u64(tmp, q);
+        int e10 = E - p + 1;
+        tmp[tl++] = 'e';
+        if (e10 < 0) {
+            tmp[tl++] = '-';
+            e10 = -e10;
+        }
+        tl += put_u64(tmp + tl, (uint64_t)e10);
+        tmp[tl] = '\0';
+        if (strtof(tmp, NULL) == (float)x) break; // Читается обратно - кратчайшая найдена
+    }
+    if (p > 9) p = 9;
+
+    char digits[20];
+    put_digits(digits + p, q, (size_t)p);
+
+    if (E >= 0 && E < 21) {                  // Позиционная: 123.45, 1200
+        if (p <= E + 1) {
+            memcpy(dst + len, digits, (size_t)p);
+            memset(dst + len + p, '0', (size_t)(E + 1 - p));
+            return len + (size_t)E + 1;
+        }
+        memcpy(dst + len, digits, (size_t)E + 1);
+        len += (size_t)E + 1;
+        dst[len++] = '.';
+        memcpy(dst + len, digits + E + 1, (size_t)(p - E - 1));
+        return len + (size_t)(p - E - 1);
+    }
+    if (E < 0 && E > -7) {                   // 0.000123
+        dst[len++] = '0';
+        dst[len++] = '.';
+        memset(dst + len, '0', (size_t)(-E - 1));
+        len += (size_t)(-E - 1);
+        memcpy(dst + len, digits, (size_t)p);
+        return len + (size_t)p;
+    }
+
+    dst[len++] = digits[0];                  // Экспоненциальная: 1.5e+30, 1e-45
+    if (p > 1) {
+        dst[len++] = '.';
+        memcpy(dst + len, digits + 1, (size_t)p - 1);
+        len += (size_t)p - 1;
+    }
+    dst[len++] = 'e';
+    dst[len++] = E < 0 ? '-' : '+';
+    unsigned ae = (unsigned)(E < 0 ? -E : E);
+    if (ae < 10) dst[len++] = '0';           // Как printf: минимум две цифры порядка
+    return len + put_u64(dst + len, ae);
+}
+
+/*
+ * write_float_to_buffer - строка результата "Sum: <число>\n" БЕЗ printf
+ *
+ * num - сумма строки: float из текста (в double без потерь) или double
+ * из двоичного входа. Кратчайшая запись - всегда для float.
+ */
+static int write_float_to_buffer(char *buf, double num) {
+    size_t pos = 5;
+    memcpy(buf, "Sum: ", 5);                 // Префикс "Sum: "
+
+    if (fmt_precision == FMT_SHORTEST) pos += fmt_shortest(buf + pos, (float)num);
+    else pos += fmt_fixed(buf + pos, num, fmt_precision);
+
+    buf[pos++] = '\n';                       // Конец строки
+    return (int)pos;                         // Количество записанных символов
+}
+
+/*
+ * write_dec_to_buffer - "Sum: <число>\n" для --decimal
+ *
+ * v - сумма в единицах 10^-fmt_precision: целая часть и дробь - просто
+ * частное и остаток от деления на 10^fmt_precision, округлять нечего.
+ */
+static int write_dec_to_buffer(char *buf, int64_t v) {
+    size_t pos = 5;
+    memcpy(buf, "Sum: ", 5);
+    uint64_t a = v < 0 ? 0 - (uint64_t)v : (uint64_t)v; // Модуль (и для INT64_MIN)
+    if (v < 0) buf[pos++] = '-';
+    uint64_t scale = pow10_u64[fmt_precision];
+    pos += put_fixed(buf + pos, a / scale, a % scale, fmt_precision);
+    buf[pos++] = '\n';
+    return (int)pos;
+}
+
+/* ============================================================================
+ * РАЗБОР ЧИСЕЛ: SIMD-классификация + точный быстрый путь
+ *
+ * strtof() на каждый токен - самое горячее место дочернего: разбор локали,
+ * errno, повторный пропуск пробелов. Здесь разбор идёт в два этапа:
+ *
+ * 1. Классификация: строка режется на блоки по 64 байта, для каждого
+ *    блока строятся битовые маски "цифра" и "разделитель" (пробел/таб).
+ *    AVX2 обрабатывает 32 байта за сравнение, SSE2 - 16, без SIMD -
+ *    побайтовый цикл. Вариант выбирается один раз при старте (simd_init).
+ * 2. Разбор токенов по маскам: длина серии цифр = ctz(~mask), цифры
+ *    сворачиваются по 8 за раз (SWAR), порядок - таблица степеней 10.
+ *
+ * Результат ОБЯЗАН совпадать со strtof() бит в бит:
+ * - мантисса <= 2^24 и |порядок| <= 10: одно умножение/деление float
+ *   над точно представимыми операндами = корректное округление;
+ * - мантисса <= 2^53 и |порядок| <= 22: то же в double, затем (float) -
+ *   годится, если double-результат не попал ровно на середину между
+ *   соседними float (иначе двойное округление могло бы ошибиться);
+ * - всё остальное (inf/nan/hex, длинные мантиссы, большие порядки,
+ *   денормалы, переполнение) - честный strtof() с проверкой ERANGE.
+ * ============================================================================ */
+
+#define CLASS_BLOCK 64                       // Байт на одно слово маски
+
+/* Маски одного 64-байтного блока: бит i = класс байта p[i] */
+typedef struct {
+    uint64_t digit;                          // '0'..'9'
+    uint64_t sep;                            // ' ' или '\t'
+} ClassMask;
+
+/* classify64_scalar - побайтовый вариант (без SIMD) */
+static void classify64_scalar(const char *p, ClassMask *m) {
+    uint64_t digit = 0, sep = 0;
+
+    for (int i = 0; i < CLASS_BLOCK; i++) {
+        unsigned char c = (unsigned char)p[i];
+        digit |= (uint64_t)((unsigned)(c - '0') < 10u) << i; // Беззнаковое сравнение: одна проверка диапазона
+        sep |= (uint64_t)(c == ' ' || c == '\t') << i;
+    }
+
+    m->digit = digit;
+    m->sep = sep;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* classify64_sse2 - 16 байт за сравнение (SSE2 есть на любом x86-64) */
+__attribute__((target("sse2")))
+static void classify64_sse2(const char *p, ClassMask *m) {
+    const __m128i lo = _mm_set1_epi8('0' - 1 - (char)0x80); // Сдвиг в знаковый диапазон для cmpgt
+    const __m128i hi = _mm_set1_epi8('9' + 1 - (char)0x80);
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    uint64_t digit = 0, sep = 0;
+
+    for (int i = 0; i < CLASS_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_xor_si128(v, bias);  // Байты без знака -> со знаком
+        __m128i d = _mm_and_si128(_mm_cmpgt_epi8(b, lo), _mm_cmplt_epi8(b, hi));
+        __m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+        digit |= (uint64_t)(unsigned)_mm_movemask_epi8(d) << i; // movemask: старший бит каждого байта -> бит маски
+        sep |= (uint64_t)(unsigned)_mm_movemask_epi8(s) << i;
+    }
+
+    m->digit = digit;
+    m->sep = sep;
+}
+
+/* classify64_avx2 - 32 байта за сравнение */
+__attribute__((target("avx2")))
+static void classify64_avx2(const char *p, ClassMask *m) {
+    const __m256i lo = _mm256_set1_epi8('0' - 1 - (char)0x80);
+    const __m256i hi = _mm256_set1_epi8('9' + 1 - (char)0x80);
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    uint64_t digit = 0, sep = 0;
+
+    for (int i = 0; i < CLASS_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_xor_si256(v, bias);
+        __m256i d = _mm256_and_si256(_mm256_cmpgt_epi8(b, lo), _mm256_cmpgt_epi8(hi, b));
+        __m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+        digit |= (uint64_t)(uint32_t)_mm256_movemask_epi8(d) << i;
+        sep |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << i;
+    }
+
+    m->digit = digit;
+    m->sep = sep;
+}
+#endif
+
+static void (*classify64)(const char *, ClassMask *) = classify64_scalar; // Выбранный вариант
+
+/* ============================================================================
+ * ИНДЕКС СТРОК: где в куске кончаются строки
+ *
+ * Раньше main() шёл по куску побайтово, копируя каждый символ в line[].
+ * Теперь кусок сначала целиком сканируется на '\n' блоками по 64 байта:
+ * cmpeq с '\n' -> movemask -> 64-битная маска, и номера единичных битов
+ * (ctz, затем mask &= mask - 1) пишутся в таблицу смещений lidx.end[].
+ * Дальше разбор прыгает сразу к границам строк, а --threads делит кусок
+ * на равные по байтам части двоичным поиском по таблице - без повторного
+ * memchr() по данным.
+ *
+ * Смещения - uint32_t: кусок не больше SHM_CAP_MAX (64 МБ). Таблица
+ * своя у каждого дочернего (и потока --inproc): её читает только он.
+ * Хвост куска короче блока сканируется memchr() - за концом данных может
+ * не быть отображённой памяти (--zero-copy).
+ * ============================================================================ */
+
+#define NL_BLOCK 64                          // Байт на одно слово маски '\n'
+
+static CHILD_LOCAL struct {
+    uint32_t *end;                           // Смещения '\n' в куске по возрастанию
+    size_t cap;                              // Мест в end[]
+} lidx;
+
+/* lidx_grow - место ещё хотя бы под need смещений */
+static __attribute__((noinline)) void lidx_grow(size_t need) {
+    size_t cap = lidx.cap ? 2 * lidx.cap : 4096;
+    while (cap < need) cap *= 2;
+    uint32_t *end = realloc(lidx.end, cap * sizeof(*end));
+    if (!end) {
+        safe_write(STDERR_FILENO, "Out of memory\n", 14);
+        _exit(1);
+    }
+    lidx.end = end;
+    lidx.cap = cap;
+}
+
+/* nl_emit - дописать в таблицу позиции единичных битов маски блока base */
+static inline size_t nl_emit(uint64_t mask, size_t base, size_t n) {
+    uint32_t *end = lidx.end;
+
+    while (mask) {
+        end[n++] = (uint32_t)(base + (size_t)__builtin_ctzll(mask));
+        mask &= mask - 1;                    // Сбросить младший единичный бит
+    }
+    return n;
+}
+
+/* nl_scan_memchr - вариант без SIMD: memchr() от '\n' до '\n' */
+static size_t nl_scan_memchr(const char *p, size_t size, size_t n) {
+    const char *s = p, *end = p + size;
+
+    while (s < end && (s = memchr(s, '\n', (size_t)(end - s))) != NULL) {
+        if (n == lidx.cap) lidx_grow(n + 1);
+        lidx.end[n++] = (uint32_t)(s - p);
+        s++;
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* nl_scan_sse2 - целые блоки по 64 байта, 16 байт за сравнение */
+__attribute__((target("sse2")))
+static size_t nl_scan_sse2(const char *p, size_t size, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    for (size_t i = 0; i + NL_BLOCK <= size; i += NL_BLOCK) {
+        if (n + NL_BLOCK > lidx.cap) lidx_grow(n + NL_BLOCK); // Блок даст не больше 64 смещений
+        uint64_t mask = 0;
+        for (int j = 0; j < NL_BLOCK; j += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + (size_t)j));
+            mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << j;
+        }
+        n = nl_emit(mask, i, n);
+    }
+    return n;
+}
+
+/* nl_scan_avx2 - целые блоки по 64 байта, 32 байта за сравнение */
+__attribute__((target("avx2")))
+static size_t nl_scan_avx2(const char *p, size_t size, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+
+    for (size_t i = 0; i + NL_BLOCK <= size; i += NL_BLOCK) {
+        if (n + NL_BLOCK > lidx.cap) lidx_grow(n + NL_BLOCK);
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t mask = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+        n = nl_emit(mask, i, n);
+    }
+    return n;
+}
+#endif
+
+static size_t (*nl_scan_blocks)(const char *, size_t, size_t) = NULL; // Выбранный вариант (NULL - только memchr)
+
+/*
+ * index_lines - таблица смещений '\n' куска data[0..size) в lidx.end[]
+ *
+ * Возвращает число строк, закончившихся в куске.
+ */
+static size_t index_lines(const char *data, size_t size) {
+    size_t full = nl_scan_blocks ? size / NL_BLOCK * NL_BLOCK : 0; // Байт в целых блоках
+    size_t n = full ? nl_scan_blocks(data, full, 0) : 0;
+    size_t tail = nl_scan_memchr(data + full, size - full, n); // Смещения хвоста - от data + full
+
+    for (size_t k = n; k < tail; k++) lidx.end[k] += (uint32_t)full;
+    return tail;
+}
+
+/* ============================================================================
+ * ДВОИЧНЫЙ ВХОД: сумма строки без разбора текста
+ *
+ * Строка двоичного файла (BinHeader, common.h) - подряд лежащие float32
+ * или float64 прямо в отображённом файле. Сумма копится в double (для
+ * float32 - точнее, чем float-сумма текстового пути; в последних знаках
+ * больших чисел результаты могут отличаться).
+ *
+ * Порядок сложения одинаков во всех вариантах, поэтому результат не
+ * зависит от процессора: 8 частичных сумм (число i идёт в сумму i % 8),
+ * затем свёртка (s0+s4, s1+s5, s2+s6, s3+s7) -> ((0+4)+(2+6), (1+5)+(3+7))
+ * -> одна сумма, и хвост (n % 8 чисел) по одному.
+ * - AVX-512: 8 double в одном регистре zmm (float32 - через vcvtps2pd);
+ * - AVX2: два регистра ymm по 4 double;
+ * - скалярный вариант - массив из 8 сумм.
+ * ============================================================================ */
+
+/* sum_fold8 - свёртка 8 частичных сумм в фиксированном порядке */
+static inline double sum_fold8(const double s[8]) {
+    double t0 = s[0] + s[4], t1 = s[1] + s[5], t2 = s[2] + s[6], t3 = s[3] + s[7];
+    return (t0 + t2) + (t1 + t3);
+}
+
+static double sum_f32_scalar(const float *v, size_t n) {
+    double s[8] = {0};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; k++) s[k] += v[i + k];
+    }
+    double r = sum_fold8(s);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+
+static double sum_f64_scalar(const double *v, size_t n) {
+    double s[8] = {0};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; k++) s[k] += v[i + k];
+    }
+    double r = sum_fold8(s);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* sum_fold_avx2 - свёртка a = (s0..s3), b = (s4..s7) в том же порядке, что sum_fold8 */
+__attribute__((target("avx2")))
+static inline double sum_fold_avx2(__m256d a, __m256d b) {
+    __m256d t = _mm256_add_pd(a, b);         // t0..t3
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(t), _mm256_extractf128_pd(t, 1)); // (t0+t2, t1+t3)
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+__attribute__((target("avx2")))
+static double sum_f32_avx2(const float *v, size_t n) {
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(v + i);   // 8 float -> две четвёрки double
+        a = _mm256_add_pd(a, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+        b = _mm256_add_pd(b, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+    }
+    double r = sum_fold_avx2(a, b);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+
+__attribute__((target("avx2")))
+static double sum_f64_avx2(const double *v, size_t n) {
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_add_pd(a, _mm256_loadu_pd(v + i));
+        b = _mm256_add_pd(b, _mm256_loadu_pd(v + i + 4));
+    }
+    double r = sum_fold_avx2(a, b);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+
+__attribute__((target("avx512f")))
+static double sum_f32_avx512(const float *v, size_t n) {
+    __m512d acc = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm512_add_pd(acc, _mm512_cvtps_pd(_mm256_loadu_ps(v + i))); // 8 float -> 8 double
+    }
+    double s[8];
+    _mm512_storeu_pd(s, acc);                // Свёртка - в общем порядке (не _mm512_reduce_add_pd)
+    double r = sum_fold8(s);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+
+__attribute__((target("avx512f")))
+static double sum_f64_avx512(const double *v, size_t n) {
+    __m512d acc = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm512_add_pd(acc, _mm512_loadu_pd(v + i));
+    }
+    double s[8];
+    _mm512_storeu_pd(s, acc);
+    double r = sum_fold8(s);
+    for (; i < n; i++) r += v[i];
+    return r;
+}
+#endif
+
+static double (*sum_f32)(const float *, size_t) = sum_f32_scalar;   // Выбранный вариант (simd_init)
+static double (*sum_f64)(const double *, size_t) = sum_f64_scalar;
+
+/* ============================================================================
+ * АГРЕГАТЫ СТРОКИ (--agg): count, min, max, mean, var за один проход
+ *
+ * Разбор складывает числа строки блоками по AGG_BLOCK в ParseState, и
+ * блок обрабатывают векторные ядра, пока он лежит в L1: min/max - по 8
+ * float за сравнение, среднее блока - sum_f32(), дисперсия - сумма
+ * квадратов отклонений от среднего блока (тот же порядок 8 частичных
+ * сумм, что у sum_f32: результат не зависит от процессора). Блоки
+ * сливаются формулой Чана - среднее и M2 всей строки без второго прохода
+ * и без потери точности формулы sum(x^2) - sum(x)^2 / n.
+ * Сумма по-прежнему копится во float по порядку в самом разборе, поэтому
+ * "Sum:" совпадает с выводом без --agg. NaN не участвует в min/max
+ * (сравнение с NaN ложно), а среднее и дисперсию делает NaN.
+ * ============================================================================ */
+
+#define AGG_BLOCK 256                        // Чисел в блоке (1 КБ float / 2 КБ int64)
+
+/* minmax_f32_scalar - обновить *mn и *mx числами v[0..n) */
+static void minmax_f32_scalar(const float *v, size_t n, float *mn, float *mx) {
+    float lo = *mn, hi = *mx;
+
+    for (size_t i = 0; i < n; i++) {
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    *mn = lo;
+    *mx = hi;
+}
+
+/* sqdev_f32_scalar - сумма (v[i] - m)^2 в порядке sum_f32 */
+static double sqdev_f32_scalar(const float *v, size_t n, double m) {
+    double s[8] = {0};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; k++) {
+            double d = v[i + k] - m;
+            s[k] += d * d;
+        }
+    }
+    double r = sum_fold8(s);
+    for (; i < n; i++) {
+        double d = v[i] - m;
+        r += d * d;
+    }
+    return r;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void minmax_f32_avx2(const float *v, size_t n, float *mn, float *mx) {
+    __m256 lo = _mm256_set1_ps(*mn), hi = _mm256_set1_ps(*mx);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(v + i);
+        lo = _mm256_min_ps(x, lo);           // При NaN в x результат - второй операнд: NaN пропускается
+        hi = _mm256_max_ps(x, hi);
+    }
+    float l[8], h[8];
+    _mm256_storeu_ps(l, lo);
+    _mm256_storeu_ps(h, hi);
+    for (int k = 0; k < 8; k++) {            // Свёртка 8 полос
+        if (l[k] < *mn) *mn = l[k];
+        if (h[k] > *mx) *mx = h[k];
+    }
+    minmax_f32_scalar(v + i, n - i, mn, mx); // Хвост
+}
+
+__attribute__((target("avx2")))
+static double sqdev_f32_avx2(const float *v, size_t n, double m) {
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd(), mm = _mm256_set1_pd(m);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(v + i);
+        __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), mm);
+        __m256d d1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), mm);
+        a = _mm256_add_pd(a, _mm256_mul_pd(d0, d0)); // Без FMA: то же округление, что у скалярного варианта
+        b = _mm256_add_pd(b, _mm256_mul_pd(d1, d1));
+    }
+    double r = sum_fold_avx2(a, b);
+    for (; i < n; i++) {
+        double d = v[i] - m;
+        r += d * d;
+    }
+    return r;
+}
+#endif
+
+static void (*minmax_f32)(const float *, size_t, float *, float *) = minmax_f32_scalar; // Выбранный вариант
+static double (*sqdev_f32)(const float *, size_t, double) = sqdev_f32_scalar;
+
+/* simd_init - выбор вариантов классификации, индекса строк, суммирования и агрегатов по возможностям процессора */
+static void simd_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        classify64 = classify64_avx2;
+        nl_scan_blocks = nl_scan_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        classify64 = classify64_sse2;
+        nl_scan_blocks = nl_scan_sse2;
+    }
+
+    if (__builtin_cpu_supports("avx512f")) {
+        sum_f32 = sum_f32_avx512;
+        sum_f64 = sum_f64_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        sum_f32 = sum_f32_avx2;
+        sum_f64 = sum_f64_avx2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        minmax_f32 = minmax_f32_avx2;
+        sqdev_f32 = sqdev_f32_avx2;
+    }
+#endif
+}
+
+/* run_ones - длина серии единичных битов маски, начиная с бита pos */
+static inline size_t run_ones(const uint64_t *bits, size_t pos) {
+    size_t n = 0;
+
+    for (;;) {
+        size_t left = 64 - pos % 64;         // Битов от pos до конца слова
+        uint64_t w = ~(bits[pos / 64] >> (pos % 64)); // Единицы серии -> нули (сдвинутые нули сверху -> единицы)
+        size_t k = w ? (size_t)__builtin_ctzll(w) : 64; // ctz: число младших нулевых битов
+        if (k < left) return n + k;          // Серия кончилась внутри слова
+        n += left;                           // Серия до конца слова, продолжаем в следующем
+        pos += left;
+    }
+}
+
+/*
+ * parse_digits - значение n <= 19 подряд идущих цифр
+ *
+ * По 8 цифр за раз: 8 байт читаются одним словом, из каждого вычитается
+ * '0', затем пары/четвёрки/восьмёрки складываются умножениями (SWAR).
+ * Чтение за концом серии безопасно: за отрезком есть запас LINE_PAD.
+ */
+static inline uint64_t parse_digits(const char *p, size_t n) {
+    uint64_t value = 0;
+
+    while (n > 0) {
+        size_t k = n < 8 ? n : 8;            // Цифр в этом шаге
+        uint64_t v;
+        memcpy(&v, p, 8);                    // Невыровненное чтение 8 байт
+        v -= 0x3030303030303030ULL;          // ASCII -> 0..9 в каждом байте
+        v <<= 8 * (8 - k);                   // Лишние байты уходят, недостающие = ведущие нули
+        v = (v * 10) + (v >> 8);             // Пары цифр
+        v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+             (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+
+        static const uint64_t pow10_k[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+        value = value * pow10_k[k] + v;
+        p += k;
+        n -= k;
+    }
+
+    return value;
+}
+
+/* Точно представимые степени 10 */
+static const float pow10_f[11] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+static const double pow10_d[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * parse_float_fast - разбор одного десятичного числа без strtof
+ *
+ * i - начало токена в line, masks - маски строки. Возвращает 1 и
+ * позицию за числом в *end, если результат гарантированно совпадает со
+ * strtof(); 0 - "трудный случай", вызывающий должен использовать strtof().
+ */
+static int parse_float_fast(const char *line, const uint64_t *digit, size_t i, size_t *end, float *out) {
+    int neg = 0;
+
+    if (line[i] == '-' || line[i] == '+') {  // Знак
+        neg = (line[i] == '-');
+        i++;
+    }
+
+    size_t int_start = i;
+    size_t n_int = run_ones(digit, i);       // Цифры целой части
+    i += n_int;
+    size_t frac_start = i, n_frac = 0;
+
+    if (line[i] == '.') {
+        frac_start = i + 1;
+        n_frac = run_ones(digit, frac_start); // Цифры дробной части
+        i = frac_start + n_frac;
+    }
+
+    if (n_int + n_frac == 0) return 0;       // "", ".", "inf", "nan" - не наш случай
+    if (n_int == 1 && line[int_start] == '0' && (line[i] | 0x20) == 'x') return 0; // Hex: 0x...
+
+    /* Ведущие нули не влияют на значение, но занимают место в 19 цифрах */
+    while (n_int > 0 && line[int_start] == '0') {
+        int_start++;
+        n_int--;
+    }
+    if (n_int + n_frac > 19) return 0;       // Не помещается в uint64_t
+
+    uint64_t mant = parse_digits(line + int_start, n_int);
+    if (n_frac > 0) {
+        mant = mant * pow10_u64[n_frac] + parse_digits(line + frac_start, n_frac);
+    }
+    int exp10 = -(int)n_frac;
+
+    if ((line[i] | 0x20) == 'e') {           // Порядок: e[+-]цифры (без цифр 'e' не часть числа)
+        size_t j = i + 1;
+        int eneg = 0;
+        if (line[j] == '-' || line[j] == '+') {
+            eneg = (line[j] == '-');
+            j++;
+        }
+        size_t n_exp = run_ones(digit, j);
+        if (n_exp > 0) {
+            if (n_exp > 3) return 0;         // Огромный порядок - пусть решает strtof
+            int e = (int)parse_digits(line + j, n_exp);
+            exp10 += eneg ? -e : e;
+            i = j + n_exp;
+        }
+    }
+
+    *end = i;
+
+    if (mant == 0) {                         // Ноль любой записи (сохраняем знак: -0.0)
+        *out = neg ? -0.0f : 0.0f;
+        return 1;
+    }
+
+    float f;
+    if (mant <= (1ULL << 24) && exp10 >= -10 && exp10 <= 10) {
+        f = (float)mant;                     // Точно: мантисса <= 2^24
+        f = (exp10 < 0) ? f / pow10_f[-exp10] : f * pow10_f[exp10]; // Одно округление
+    } else if (mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double d = (double)mant;             // Точно: мантисса <= 2^53
+        d = (exp10 < 0) ? d / pow10_d[-exp10] : d * pow10_d[exp10]; // Корректно округлённый double
+        if (!(d >= FLT_MIN && d <= FLT_MAX)) return 0; // Денормал/переполнение: strtof + ERANGE
+
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        if ((bits & 0x1FFFFFFFULL) == 0x10000000ULL) return 0; // Ровно середина между float - двойное округление
+        f = (float)d;
+    } else {
+        return 0;
+    }
+
+    *out = neg ? -f : f;
+    return 1;
+}
+
+/* ============================================================================
+ * РАЗБОР СТРОКИ НА МЕСТЕ: (ptr, len) прямо в in[] или в отображённом файле
+ *
+ * Строка больше не копируется в line[256] (и не обрезается до 255 байт):
+ * маски и числа читаются прямо из куска. Это требует LINE_PAD читаемых
+ * байт за концом отрезка - классификация читает блоки по 64 байта,
+ * parse_digits() - по 8; лишнее отбрасывается масками. В слоте за in[]
+ * всегда лежит out[] (не меньше SHM_CAP_MIN), за отображённым файлом
+ * --zero-copy - сторожевая страница (см. main). Байт СРАЗУ за отрезком
+ * должен быть ограничителем числа ('\n', ' ' или '\t'): '\0' больше не
+ * пишется, а strtof(), ушедший за конец отрезка, - ошибка разбора.
+ *
+ * Строка может прийти кусками (она длиннее куска или разрезана его
+ * границей). ParseState - состояние разбора ОДНОЙ строки между кусками:
+ * line_feed() разбирает все токены куска, кроме последнего, и запоминает
+ * недописанный токен в tok[]; line_end() дописывает его началом
+ * следующего куска, разбирает и возвращает сумму. Резать строку между
+ * токенами безопасно: число никогда не содержит ' ' и '\t'. Копируются
+ * только байты одного токена на границе куска.
+ * ============================================================================ */
+
+#define LINE_PAD (CLASS_BLOCK + 8)           // Читаемых байт за концом отрезка
+
+/* ParseState - разбор одной строки (свой у main и у каждого потока --threads) */
+typedef struct {
+    float sum;                               // Сумма чисел строки до сих пор
+    int64_t acc;                             // То же для --decimal (единицы 10^-fmt_precision)
+    int open;                                // Строка начата в прошлом куске
+    char *tok;                               // Недописанный токен (с запасом LINE_PAD)
+    size_t tok_len, tok_cap;
+    uint64_t *digit, *sep;                   // Маски классов отрезка (+1 слово - ограничитель)
+    size_t words_cap;
+
+    /* --agg (кроме sum): блок чисел для векторных ядер и итоги прошлых блоков */
+    union {
+        float f[AGG_BLOCK];
+        int64_t d[AGG_BLOCK];                // --decimal
+    } blk;
+    size_t nvals;                            // Чисел в blk
+    uint64_t count;                          // Чисел в прошлых блоках
+    double mean, m2;                         // Их среднее и сумма квадратов отклонений
+    float mn, mx;
+    int64_t dmn, dmx;                        // --decimal
+} ParseState;
+
+/* parse_grow - realloc() или аварийное завершение */
+static void *parse_grow(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        safe_write(STDERR_FILENO, "Out of memory\n", 14);
+        _exit(1);
+    }
+    return p;
+}
+
+/* parse_free - освободить буферы состояния */
+static void parse_free(ParseState *ps) {
+    free(ps->tok);
+    free(ps->digit);
+    free(ps->sep);
+    memset(ps, 0, sizeof(*ps));
+}
+
+/*
+ * parse_fail - ошибка во входе ("Parse error\n", "Number too large\n")
+ *
+ * Обычный дочерний завершается: его файл - единственный. С --server пул
+ * общий (демон, пакет), и плохая строка одного файла не должна убивать
+ * воркера для остальных: запоминается первая ошибка (потоки --threads
+ * тоже сюда пишут), вызывающий бросает разбор, а main() отвечает родителю
+ * SHM_FAILED вместо результатов куска и сбрасывает разбор (parse_reset).
+ */
+static void parse_fail(const char *msg, size_t len) {
+    if (!server_mode) {
+        safe_write(STDERR_FILENO, msg, len);
+        _exit(1);                            // Аварийное завершение
+    }
+    const char *none = NULL;
+    atomic_compare_exchange_strong(&input_error, &none, msg);
+}
+
+/* parse_reset - забыть недоразобранную строку (буферы остаются) */
+static void parse_reset(ParseState *ps) {
+    ps->sum = 0.0f;
+    ps->acc = 0;
+    ps->open = 0;
+    ps->tok_len = 0;
+    ps->nvals = 0;
+    ps->count = 0;
+    ps->mean = ps->m2 = 0.0;
+}
+
+/* agg_merge - слить блок из n чисел (среднее bmean, M2 bm2) с итогами строки (формула Чана) */
+static void agg_merge(ParseState *ps, size_t n, double bmean, double bm2) {
+    if (ps->count == 0) {
+        ps->mean = bmean;
+        ps->m2 = bm2;
+        return;
+    }
+    double total = (double)(ps->count + n);
+    double delta = bmean - ps->mean;
+    ps->mean += delta * (double)n / total;
+    ps->m2 += bm2 + delta * delta * (double)ps->count * (double)n / total;
+}
+
+/* agg_flush - обработать накопленный блок чисел строки */
+static void agg_flush(ParseState *ps) {
+    size_t n = ps->nvals;
+    if (n == 0) return;
+
+    if (ps->count == 0) {                    // Первый блок строки
+        ps->mn = INFINITY;                   // Только NaN - min > max, выводится nan
+        ps->mx = -INFINITY;
+        ps->dmn = INT64_MAX;
+        ps->dmx = INT64_MIN;
+    }
+
+    if (dec_mode) {                          // int64: точные min/max, среднее и M2 - в double (единицы 10^-P)
+        const int64_t *v = ps->blk.d;
+        double bsum = 0.0, bm2 = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            if (v[i] < ps->dmn) ps->dmn = v[i];
+            if (v[i] > ps->dmx) ps->dmx = v[i];
+            bsum += (double)v[i];
+        }
+        double bmean = bsum / (double)n;
+        if (agg_mask & AGG_VAR) {
+            for (size_t i = 0; i < n; i++) bm2 += ((double)v[i] - bmean) * ((double)v[i] - bmean);
+        }
+        agg_merge(ps, n, bmean, bm2);
+    } else {
+        const float *v = ps->blk.f;
+        if (agg_mask & (AGG_MIN | AGG_MAX)) minmax_f32(v, n, &ps->mn, &ps->mx);
+        if (agg_mask & (AGG_MEAN | AGG_VAR)) {
+            double bmean = sum_f32(v, n) / (double)n;
+            agg_merge(ps, n, bmean, (agg_mask & AGG_VAR) ? sqdev_f32(v, n, bmean) : 0.0);
+        }
+    }
+
+    ps->count += n;
+    ps->nvals = 0;
+}
+
+/* is_sep - разделитель чисел (как маска sep) */
+static inline int is_sep(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/* ============================================================================
+ * --decimal: ТОЧНАЯ СУММА В ФИКСИРОВАННОЙ ТОЧКЕ
+ *
+ * Цены и суммы денег - десятичные дроби с немногими знаками, а float
+ * хранит их приближённо: в "-4.5 15005.0 0.01" сумма float теряет
+ * последний знак, и результат зависит от порядка сложения. В режиме
+ * --decimal число [+-]цифры[.цифры] переводится сразу в int64 в единицах
+ * 10^-P (P = --precision): цифры - теми же масками и parse_digits(), что
+ * и быстрый путь float, без strtof и без плавающей точки. Сумма строки -
+ * сложение int64 с проверкой переполнения: точна и не зависит от порядка.
+ *
+ * Знаков дроби больше P - округление к ближайшему (при равенстве - к
+ * чётному), как при печати; порядок (1e5), inf/nan/hex - ошибка разбора.
+ * |число| и |сумма| должны помещаться в 18 десятичных разрядов с учётом
+ * P знаков дроби (P = 2: до 10^16), иначе - "Number too large".
+ * ============================================================================ */
+
+/*
+ * dec_parse - число с позиции i отрезка line в *out (единицы 10^-P)
+ *
+ * Возвращает позицию за числом или SIZE_MAX - ошибка (parse_fail).
+ */
+static size_t dec_parse(const char *line, const uint64_t *digit, size_t i, int64_t *out) {
+    int neg = 0;
+    int prec = fmt_precision;
+
+    if (line[i] == '-' || line[i] == '+') {  // Знак
+        neg = (line[i] == '-');
+        i++;
+    }
+
+    size_t int_start = i;
+    size_t n_int = run_ones(digit, i);       // Цифры целой части
+    i += n_int;
+    size_t frac_start = i, n_frac = 0;
+    if (line[i] == '.') {
+        frac_start = i + 1;
+        n_frac = run_ones(digit, frac_start); // Цифры дробной части
+        i = frac_start + n_frac;
+    }
+    if (n_int + n_frac == 0) {               // "", ".", "e5", "inf"...
+        parse_fail("Parse error\n", 12);
+        return SIZE_MAX;
+    }
+
+    while (n_int > 0 && line[int_start] == '0') { // Ведущие нули не занимают разрядов
+        int_start++;
+        n_int--;
+    }
+    if (n_int + (size_t)prec > 18) {         // 10^18 < 2^63
+        parse_fail("Number too large\n", 17);
+        return SIZE_MAX;
+    }
+
+    size_t k = n_frac < (size_t)prec ? n_frac : (size_t)prec; // Знаков дроби, которые помещаются
+    uint64_t m = parse_digits(line + int_start, n_int) * pow10_u64[prec] +
+                 parse_digits(line + frac_start, k) * pow10_u64[prec - (int)k];
+
+    if (n_frac > k) {                        // Лишние знаки: к ближайшему, при равенстве - к чётному
+        const char *rest = line + frac_start + k;
+        int up = rest[0] > '5';
+        if (rest[0] == '5') {
+            size_t j = 1;
+            while (j < n_frac - k && rest[j] == '0') j++;
+            up = j < n_frac - k || (m & 1);  // Больше половины - вверх; ровно половина - к чётному
+        }
+        m += (uint64_t)up;
+    }
+
+    *out = neg ? -(int64_t)m : (int64_t)m;
+    return i;
+}
+
+/* dec_span - сложить в ps->acc числа отрезка (маски уже построены) */
+static void dec_span(ParseState *ps, const char *line, size_t len) {
+    const uint64_t *sep = ps->sep;
+    int64_t acc = ps->acc;
+    size_t i = 0;
+
+    while (i < len) {
+        i += run_ones(sep, i);               // Пропускаем пробелы и табы
+        if (i >= len) break;
+
+        int64_t v;
+        i = dec_parse(line, ps->digit, i, &v);
+        if (i == SIZE_MAX) return;           // --server: остаток файла всё равно пропускается
+        if (__builtin_add_overflow(acc, v, &acc)) {
+            parse_fail("Number too large\n", 17);
+            return;
+        }
+        if (agg_mask != AGG_SUM) {           // --agg: число - ещё и в блок агрегатов
+            ps->blk.d[ps->nvals++] = v;
+            if (ps->nvals == AGG_BLOCK) agg_flush(ps);
+        }
+    }
+
+    ps->acc = acc;
+}
+
+/*
+ * parse_span - сложить в ps->sum (ps->acc) числа отрезка line[0..len)
+ *
+ * line[len] - ограничитель, за ним ещё LINE_PAD читаемых байт.
+ */
+static void parse_span(ParseState *ps, const char *line, size_t len) {
+    size_t words = len / CLASS_BLOCK + 1;    // Блоков, покрывающих line[0..len]
+    if (words + 1 > ps->words_cap) {         // Маски - по длине самой длинной строки
+        ps->words_cap = 2 * (words + 1);
+        ps->digit = parse_grow(ps->digit, ps->words_cap * sizeof(uint64_t));
+        ps->sep = parse_grow(ps->sep, ps->words_cap * sizeof(uint64_t));
+    }
+    uint64_t *digit = ps->digit, *sep = ps->sep;
+
+    for (size_t w = 0; w < words; w++) {
+        ClassMask m;
+        classify64(line + w * CLASS_BLOCK, &m);
+        digit[w] = m.digit;
+        sep[w] = m.sep;
+    }
+
+    /* Биты за концом отрезка - чужие байты (следующие строки, out[]): обнуляем */
+    uint64_t keep = (len % CLASS_BLOCK) ? (~0ULL >> (CLASS_BLOCK - len % CLASS_BLOCK)) : 0;
+    digit[words - 1] &= keep;
+    sep[words - 1] &= keep;
+    digit[words] = sep[words] = 0;           // Серия не выйдет за пределы масок
+
+    if (dec_mode) {                          // --decimal: целочисленный разбор по тем же маскам
+        dec_span(ps, line, len);
+        return;
+    }
+
+    float sum = ps->sum;                     // Аккумулятор суммы (порядок сложения - слева направо)
+
+    size_t i = 0;
+    while (i < len) {                        // Пока не конец отрезка
+        i += run_ones(sep, i);               // Пропускаем пробелы и табы
+        if (i >= len) break;                 // Конец отрезка
+
+        float val;
+        size_t end;
+        if (!parse_float_fast(line, digit, i, &end, &val)) {
+            char *endp;                      // OUT параметр для strtof
+            errno = 0;                       // Сброс errno (для проверки ERANGE)
+            val = strtof(line + i, &endp);   // strtof() - преобразует строку в float, end указывает на символ после числа
+
+            if (endp == line + i || endp > line + len) { // Не распознано (или число нашлось только за концом строки)
+                parse_fail("Parse error\n", 12);
+                return;
+            }
+            if (errno == ERANGE) {           // Переполнение (число слишком большое/маленькое)
+                parse_fail("Number too large\n", 17);
+                return;
+            }
+            end = (size_t)(endp - line);
+        }
+
+        sum += val;                          // Добавляем к сумме
+        if (agg_mask != AGG_SUM) {           // --agg: число - ещё и в блок агрегатов
+            ps->blk.f[ps->nvals++] = val;
+            if (ps->nvals == AGG_BLOCK) agg_flush(ps);
+        }
+        i = end;                             // Переходим к следующему числу
+    }
+
+    ps->sum = sum;
+}
+
+/* tok_append - дописать байты к недописанному токену */
+static void tok_append(ParseState *ps, const char *p, size_t n) {
+    if (ps->tok_len + n + LINE_PAD > ps->tok_cap) {
+        ps->tok_cap = 2 * (ps->tok_len + n + LINE_PAD);
+        ps->tok = parse_grow(ps->tok, ps->tok_cap);
+    }
+    memcpy(ps->tok + ps->tok_len, p, n);
+    ps->tok_len += n;
+}
+
+/*
+ * tok_finish - токен из прошлого куска дописан началом p[0..len): разобрать
+ *
+ * Возвращает, сколько байт p ушло в токен (до первого разделителя);
+ * len - токен ещё не кончился (тогда он не разбирается).
+ */
+static size_t tok_finish(ParseState *ps, const char *p, size_t len) {
+    size_t s = 0;
+    while (s < len && !is_sep(p[s])) s++;
+    tok_append(ps, p, s);
+    if (s == len) return s;
+
+    ps->tok[ps->tok_len] = '\0';             // Ограничитель (запас LINE_PAD есть)
+    parse_span(ps, ps->tok, ps->tok_len);
+    ps->tok_len = 0;
+    return s;
+}
+
+/*
+ * line_feed - кусок p[0..len) строки, продолжение которой придёт позже
+ *
+ * Байты за p[len] не трогаются: там может не быть ограничителя.
+ */
+static void line_feed(ParseState *ps, const char *p, size_t len) {
+    size_t s = 0;
+
+    ps->open = 1;
+    if (ps->tok_len > 0) {                   // Дописываем токен, начатый раньше
+        s = tok_finish(ps, p, len);
+        if (s == len) return;
+    }
+
+    size_t r = len;                          // Последний разделитель куска - конец целых токенов
+    while (r > s && !is_sep(p[r - 1])) r--;
+    if (r > s) parse_span(ps, p + s, r - 1 - s); // p[r - 1] - разделитель, годится в ограничители
+    else r = s;
+    if (r < len) tok_append(ps, p + r, len - r); // Последний токен может продолжиться в следующем куске
+}
+
+/*
+ * line_end - последний кусок p[0..len) строки: дочитать её
+ *
+ * p[len] - ограничитель ('\n'); len == 0 - строка кончилась с файлом.
+ * Сумму забирает и сбрасывает line_put().
+ */
+static void line_end(ParseState *ps, const char *p, size_t len) {
+    size_t s = 0;
+
+    if (ps->tok_len > 0) {
+        s = tok_finish(ps, p, len);
+        if (ps->tok_len > 0) {               // Токен кончился вместе со строкой
+            ps->tok[ps->tok_len] = '\0';
+            parse_span(ps, ps->tok, ps->tok_len);
+            ps->tok_len = 0;
+        }
+    }
+    if (s < len) parse_span(ps, p + s, len - s);
 }
 
-/* write_float_to_buffer - форматирование float в строку БЕЗ printf */
-static int write_float_to_buffer(char *buf, float num) {
-    int pos = 0;                             // Текущая позиция в буфере
+/* fmt_num - число с --precision знаками (или кратчайшее), без префикса и '\n' */
+static size_t fmt_num(char *dst, double x) {
+    if (fmt_precision == FMT_SHORTEST) return fmt_shortest(dst, (float)x);
+    return fmt_fixed(dst, x, fmt_precision);
+}
 
-    buf[pos++] = 'S'; buf[pos++] = 'u'; buf[pos++] = 'm'; // Префикс "Sum: "
-    buf[pos++] = ':'; buf[pos++] = ' ';
+/* fmt_dec - значение в единицах 10^-fmt_precision (--decimal) */
+static size_t fmt_dec(char *dst, int64_t v) {
+    size_t len = 0;
+    uint64_t a = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    if (v < 0) dst[len++] = '-';
+    uint64_t scale = pow10_u64[fmt_precision];
+    return len + put_fixed(dst + len, a / scale, a % scale, fmt_precision);
+}
 
-    if (num < 0) {                           // Отрицательное число
-        buf[pos++] = '-';                    // Добавляем минус
-        num = -num;                          // Делаем положительным
-    }
+/*
+ * agg_put - строка результата с агрегатами --agg в out, возвращает длину
+ *
+ * "Sum: 1.50 Count: 2 Min: 0.50 ..." или с --columns "1.50\t2\t0.50...".
+ * У строки без чисел min/max/mean/var - nan, а с --decimal - "-": nan не
+ * значение в фиксированной точке и выглядел бы как испорченный вывод.
+ */
+static size_t agg_put(char *out, ParseState *ps) {
+    static const char *const label[AGG_KINDS] = {"Sum: ", "Count: ", "Min: ", "Max: ", "Mean: ", "Var: "};
+    double scale = dec_mode ? (double)pow10_u64[fmt_precision] : 1.0; // Единицы --decimal -> число
+    size_t pos = 0;
 
-    int whole = (int)num;                    // Целая часть (отбрасываем дробную)
-    if (whole == 0) {                        // Особый случай: 0.XX
-        buf[pos++] = '0';
-    } else {
-        char tmp[20];                        // Временный буфер для цифр
-        int tp = 0;                          // Позиция в tmp
-        
-        while (whole > 0) {                  // Извлекаем цифры (в обратном порядке)
-            tmp[tp++] = '0' + (whole % 10);  // Последняя цифра + ASCII '0'
-            whole /= 10;                     // Убираем последнюю цифру
+    agg_flush(ps);
+    for (int a = 0; a < AGG_KINDS; a++) {
+        unsigned bit = 1u << a;
+        if (!(agg_mask & bit)) continue;
+        if (pos > 0) out[pos++] = agg_columns ? '\t' : ' ';
+        if (!agg_columns) {
+            memcpy(out + pos, label[a], strlen(label[a]));
+            pos += strlen(label[a]);
         }
-        
-        while (tp > 0) {                     // Переворачиваем и копируем
-            buf[pos++] = tmp[--tp];          // Сначала старшие разряды
+
+        if (bit == AGG_SUM) {
+            pos += dec_mode ? fmt_dec(out + pos, ps->acc) : fmt_num(out + pos, ps->sum);
+        } else if (bit == AGG_COUNT) {
+            pos += put_u64(out + pos, ps->count);
+        } else if (ps->count == 0) {         // Строка без чисел
+            if (dec_mode) out[pos++] = '-';
+            else pos += fmt_special(out + pos, NAN);
+        } else if (bit == AGG_MIN || bit == AGG_MAX) {
+            if (dec_mode) pos += fmt_dec(out + pos, bit == AGG_MIN ? ps->dmn : ps->dmx);
+            else if (!(ps->mn <= ps->mx)) pos += fmt_special(out + pos, NAN); // Только NaN
+            else pos += fmt_num(out + pos, bit == AGG_MIN ? ps->mn : ps->mx);
+        } else if (bit == AGG_MEAN) {
+            pos += fmt_num(out + pos, ps->mean / scale);
+        } else {                             // AGG_VAR
+            pos += fmt_num(out + pos, ps->m2 / (double)ps->count / scale / scale);
         }
     }
+    out[pos++] = '\n';
 
-    buf[pos++] = '.';                        // Десятичная точка
+    ps->count = 0;
+    return pos;
+}
 
-    int frac = (int)((num - (int)num) * 100 + 0.5); // Дробная часть: 0.75 → 75
-    if (frac >= 100) frac = 99;              // Защита от округления (0.996 → 99)
-    buf[pos++] = '0' + (frac / 10);          // Первая цифра (десятки)
-    buf[pos++] = '0' + (frac % 10);          // Вторая цифра (единицы)
-    buf[pos++] = '\n';                       // Конец строки
+/* line_put - "Sum: ...\n" строки (или агрегаты --agg) в out и сброс состояния для следующей */
+static size_t line_put(char *out, ParseState *ps) {
+    size_t n;
+    if (agg_mask != AGG_SUM) n = agg_put(out, ps);
+    else n = dec_mode ? (size_t)write_dec_to_buffer(out, ps->acc) : (size_t)write_float_to_buffer(out, ps->sum);
 
-    return pos;                              // Количество записанных символов
+    ps->sum = 0.0f;
+    ps->acc = 0;
+    ps->open = 0;
+    return n;
 }
 
-/* process_line - парсинг строки с числами и вычисление суммы */
-static float process_line(char *line) {
-    float sum = 0.0;                         // Аккумулятор суммы
-    char *p = line;                          // Указатель на текущий символ
-    
-    while (*p) {                             // Пока не конец строки
-        while (*p == ' ' || *p == '\t') p++; // Пропускаем пробелы и табы
-        if (*p == '\0' || *p == '\n') break; // Конец строки
-        
-        char *end;                           // OUT параметр для strtof
-        errno = 0;                           // Сброс errno (для проверки ERANGE)
-        float val = strtof(p, &end);         // strtof() - преобразует строку в float, end указывает на символ после числа
-        
-        if (end == p) {                      // Не удалось распознать число (end не сдвинулся)
-            safe_write(STDERR_FILENO, "Parse error\n", 12);
-            _exit(1);                        // Аварийное завершение
-        }
-        if (errno == ERANGE) {               // Переполнение (число слишком большое/маленькое)
-            safe_write(STDERR_FILENO, "Number too large\n", 17);
-            _exit(1);
-        }
-        
-        sum += val;                          // Добавляем к сумме
-        p = end;                             // Переходим к следующему числу
+/*
+ * put_result - дочитать строку (line_end) и записать "Sum: ...\n" в out, возвращает длину
+ *
+ * detail (--stats, lab3stat): время разбора и форматирования копится
+ * отдельно - три rdtsc на строку, поэтому только по запросу.
+ */
+static inline size_t put_result(char *out, ParseState *ps, const char *line, size_t len, PhaseStats *st,
+                                int detail) {
+    if (!detail) {
+        line_end(ps, line, len);
+        return line_put(out, ps);
     }
-    
-    return sum;                              // Возвращаем сумму
+
+    unsigned long t0 = stat_ticks();
+    line_end(ps, line, len);                 // Парсим и суммируем
+    unsigned long t1 = stat_ticks();
+    size_t n = line_put(out, ps);            // Форматируем
+    st->c_parse += t1 - t0;
+    st->c_format += stat_ticks() - t1;
+    return n;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {                          // argc = количество аргументов (минимум 1: argv[0])
-        safe_write(STDERR_FILENO, "Usage: child <mmap_file>\n", 25);
-        return 1;
-    }
+/*
+ * Channel - сторона дочернего процесса в обмене с родителем
+ *
+ * Два транспорта с одинаковым интерфейсом:
+ * - семафоры (по умолчанию): одна SharedData, msync + sem_post/sem_wait;
+ * - --ring: кольцо слотов RingShared, атомики + futex (см. common.h).
+ */
+typedef struct {
+    int ring;                                // 1 = транспорт --ring
+    int use_msync;                           // 1 = бэкенд file (msync), 0 = memfd (барьеры)
+    void *map;                               // Вся отображённая область
+    size_t map_size;                         // Её размер
+    RingShared *rs;                          // Управляющие поля + слоты
+    unsigned nslots;                         // RING_SLOTS (--ring) или SHM_BUFFERS
+    unsigned long seq;                       // Номер текущего слота
+    sem_t *sem_ready;                        // Семафоры: "данные готовы"
+    sem_t *sem_done;                         // Семафоры: "обработка завершена"
+    int pshared;                             // 1 = семафоры - поля RingShared (SHM_SYNC_PSHARED)
+} Channel;
 
-    /* ====================================================================
-     * СЕМАФОРЫ: Открытие существующих семафоров
-     * 
-     * sem_open() без O_CREAT открывает СУЩЕСТВУЮЩИЙ семафор
-     * Родитель должен был создать его раньше!
-     * 
-     * Семафоры хранятся в /dev/shm/ (tmpfs в RAM)
-     * Проверить: ls -la /dev/shm/sem.os_lab3*
-     * ==================================================================== */
-    sem_t *sem_ready = sem_open(SEM_READY, 0); // 0 = нет флагов (только открыть, не создавать)
-    if (sem_ready == SEM_FAILED) {           // SEM_FAILED = ошибка (семафор не существует или нет прав)
-        safe_write(STDERR_FILENO, "sem_open ready failed in child\n", 32);
-        return 1;
-    }
+/* chan_bind_sems - семафоры в самой области: адрес меняется вместе с отображением */
+static void chan_bind_sems(Channel *ch) {
+    ch->sem_ready = &ch->rs->sem_ready;
+    ch->sem_done = &ch->rs->sem_done;
+}
 
-    sem_t *sem_done = sem_open(SEM_DONE, 0); // Открываем второй семафор
-    if (sem_done == SEM_FAILED) {
-        safe_write(STDERR_FILENO, "sem_open done failed in child\n", 31);
-        sem_close(sem_ready);                // Закрываем первый при ошибке
-        return 1;
-    }
+/*
+ * chan_fit - родитель вырастил область (worker_grow): догнать его mremap
+ *
+ * Вызывается сразу после получения слота: новые region_size/in_cap/out_cap
+ * родитель записал ДО передачи слота, поэтому здесь они уже видны.
+ * Возвращает тот же слот по новому адресу области.
+ */
+static SharedData *chan_fit(Channel *ch, SharedData *slot) {
+    size_t size = ch->rs->region_size;
+    if (size <= ch->map_size) return slot;
 
-    /* ====================================================================
-     * MMAP: Открытие файла
-     * 
-     * argv[1] содержит путь "/tmp/os_lab3_mmap"
-     * Родитель уже создал и расширил (ftruncate) этот файл
-     * ==================================================================== */
-    int mmap_fd = open(argv[1], O_RDWR);     // O_RDWR нужен для mmap с PROT_WRITE
-    if (mmap_fd < 0) {                       // Ошибка: файл не найден или нет прав
-        safe_write(STDERR_FILENO, "Cannot open mmap file\n", 22);
-        sem_close(sem_ready);
-        sem_close(sem_done);
-        return 1;
+    size_t index = (size_t)(slot - ch->rs->slot);
+    void *m = mremap(ch->map, ch->map_size, size, MREMAP_MAYMOVE); // Файл уже вырос (ftruncate родителя)
+    if (m == MAP_FAILED || shm_check(m, size) < 0) {
+        safe_write(STDERR_FILENO, "Cannot grow shared region\n", 26);
+        _exit(1);
     }
+    shm_advise(m, size, 0);                  // Страницы уже подкачал родитель - только huge pages
+    ch->map = m;
+    ch->map_size = size;
+    ch->rs = m;
+    shm_msync_ticks = &ch->rs->stats.c_msync;
+    if (ch->pshared) chan_bind_sems(ch);
+    return &ch->rs->slot[index];
+}
 
-    /* ====================================================================
-     * MMAP: Отображение в память дочернего процесса
-     * 
-     * КРИТИЧНО: параметры mmap ДОЛЖНЫ совпадать с parent.c!
-     * - Размер: MMAP_SIZE (8192)
-     * - Права: PROT_READ | PROT_WRITE
-     * - Флаги: MAP_SHARED (обязательно!)
-     * 
-     * Виртуальный адрес может отличаться от родителя:
-     * - Родитель: shared = 0x40000000
-     * - Дочерний: shared = 0x50000000
-     * НО физическая страница ОДНА (благодаря MAP_SHARED + один файл)
-     * 
-     * Как ядро связывает два процесса:
-     * 1. Родитель: mmap() → VMA → Page Table Entry → inode (файл)
-     * 2. Дочерний: mmap() → VMA → Page Table Entry → тот же inode
-     * 3. Kernel видит что оба процесса отображают один inode с MAP_SHARED
-     * 4. Выделяет ОДНУ физическую страницу для обоих
-     * 5. Оба PTE указывают на одну физическую страницу
-     * ==================================================================== */
-    SharedData *shared = mmap(               // Параметры идентичны parent.c
-        NULL,                                // ОС выбирает адрес
-        MMAP_SIZE,                           // 8192 байт
-        PROT_READ | PROT_WRITE,              // Чтение + запись
-        MAP_SHARED,                          // КРИТИЧНО для IPC!
-        mmap_fd,                             // Дескриптор файла
-        0                                    // Смещение 0 (с начала)
-    );
-    
-    if (shared == MAP_FAILED) {              // MAP_FAILED = (void*)-1
-        safe_write(STDERR_FILENO, "mmap error in child\n", 20);
-        close(mmap_fd);
-        sem_close(sem_ready);
-        sem_close(sem_done);
-        return 1;
+/* chan_next - дождаться очередного куска от родителя */
+static SharedData *chan_next(Channel *ch) {
+    SharedData *slot = &ch->rs->slot[ch->seq % ch->nslots];
+
+    if (atomic_load_explicit(&slot->state, memory_order_relaxed) != SLOT_READY) {
+        ch->rs->child_stalls++;              // Родитель ещё не дал кусок - дочерний простаивает
     }
 
-    close(mmap_fd);                          // Дескриптор больше не нужен (отображение активно)
+    PhaseStats *st = &ch->rs->stats;
+    unsigned long t0 = stat_ticks(), m0 = st->c_msync; // Ожидание - без msync внутри него
+
+    if (ch->ring) {
+        ring_wait(&slot->state, SLOT_READY, SLOT_READY, &ch->rs->child_sleeping); // acquire: in[] родителя виден
+        st->c_wait += stat_ticks() - t0;
+        return chan_fit(ch, slot);
+    }
 
     /* ====================================================================
      * СЕМАФОРЫ: Ожидание сигнала от родителя
@@ -225,7 +1675,7 @@ int main(int argc, char *argv[]) {
      *     - Продолжает выполнение после блокировки
 
      * ==================================================================== */
-    sem_wait(sem_ready);                     // Блокируется здесь пока родитель не вызовет sem_post
+    /* sem_wait(ready) до тех пор, пока родитель не отдаст НАШ буфер (флаг владения READY) */
 
     /* ====================================================================
      * MMAP: Синхронизация для чтения свежих данных
@@ -264,43 +1714,51 @@ int main(int argc, char *argv[]) {
      * 2. DSB (Data Synchronization Barrier)
      * 3. Clean cache to PoC (Point of Coherency)
      * ==================================================================== */
-    msync(shared, MMAP_SIZE, MS_SYNC);       // Обновляем наш кэш из RAM/Page Cache
+    /* Бэкенд memfd: вместо msync достаточно acquire-барьера (см. shm_acquire в common.h) */
+    sem_wait_state(&slot->state, SLOT_READY, SLOT_READY, ch->sem_ready, ch->map, ch->map_size, ch->use_msync);
+    st->c_wait += stat_ticks() - t0 - (st->c_msync - m0);
 
-    /* === ОБРАБОТКА ДАННЫХ === */
-    char output[MMAP_SIZE];                  // Буфер для результата
-    int out_pos = 0;                         // Текущая позиция в output
-    
-    char line[256];                          // Буфер для одной строки
-    int line_pos = 0;                        // Позиция в line
-    
-    for (size_t i = 0; i < shared->data_size; i++) { // Проход по всем байтам
-        char c = shared->data[i];            // Текущий символ
-        
-        if (c == '\n') {                     // Конец строки
-            if (line_pos > 0) {              // Есть что обработать
-                line[line_pos] = '\0';       // Нуль-терминатор
-                float sum = process_line(line); // Парсим и суммируем
-                out_pos += write_float_to_buffer(output + out_pos, sum); // Форматируем
-                line_pos = 0;                // Сброс для новой строки
-            }
-        } else {
-            if (line_pos < 255) {            // Защита от переполнения
-                line[line_pos++] = c;        // Добавляем символ
-            }
-        }
-    }
+    return chan_fit(ch, slot);
+}
+
+/*
+ * chan_more - отдать родителю заполненный out[] посреди куска
+ *
+ * Результатов может быть больше, чем входных байт ("1\n" -> "Sum: 1.00\n"),
+ * поэтому out[] иногда переполняется раньше, чем закончится in[].
+ * Выставляем SHM_MORE, ждём пока родитель выведет out[], и продолжаем
+ * с того же места in[] (родитель его не трогает).
+ */
+static void chan_more(Channel *ch, SharedData *slot, size_t out_pos) {
+    PhaseStats *st = &ch->rs->stats;
+    unsigned long t0 = stat_ticks(), m0 = st->c_msync;
+
+    slot->out_size = out_pos;                // Сколько результатов готово
+    slot->flags |= SHM_MORE;                 // Кусок ещё не закончен
 
-    if (line_pos > 0) {                      // Последняя строка без '\n'
-        line[line_pos] = '\0';
-        float sum = process_line(line);
-        out_pos += write_float_to_buffer(output + out_pos, sum);
+    if (ch->ring) {
+        ring_set(&slot->state, SLOT_MORE, &ch->rs->parent_sleeping); // release: out[] виден родителю
+        ring_wait(&slot->state, SLOT_READY, SLOT_READY, &ch->rs->child_sleeping);
+    } else {
+        sem_set_state(&slot->state, SLOT_MORE, ch->sem_done, ch->map, ch->map_size, ch->use_msync); // Родитель выводит out[]...
+        sem_wait_state(&slot->state, SLOT_READY, SLOT_READY, ch->sem_ready, ch->map, ch->map_size, ch->use_msync); // ...и разрешает продолжить
     }
+    st->c_wait += stat_ticks() - t0 - (st->c_msync - m0);
+}
+
+/* chan_done - кусок обработан целиком, результат в out[] */
+static void chan_done(Channel *ch, SharedData *slot, size_t out_pos) {
+    slot->out_size = out_pos;                // Обновляем размер результата
+    slot->flags &= ~SHM_MORE;                // Кусок обработан целиком
+
+    ch->seq++;                               // Следующий кусок - в следующем слоте
 
-    /* Копируем результат в shared memory */
-    for (int i = 0; i < out_pos && i < (int)sizeof(shared->data); i++) {
-        shared->data[i] = output[i];         // Побайтовое копирование
+    if (ch->ring) {
+        ring_set(&slot->state, SLOT_DONE, &ch->rs->parent_sleeping); // release: out[] виден родителю
+        return;
     }
-    shared->data_size = (size_t)out_pos;     // Обновляем размер
+
+    atomic_store_explicit(&slot->state, SLOT_DONE, memory_order_release); // Буфер возвращается родителю
 
     /* ====================================================================
      * MMAP: Синхронизация записанных данных
@@ -326,7 +1784,7 @@ int main(int argc, char *argv[]) {
      *    msync();         // ← СНАЧАЛА синхронизация
      *    sem_post(done);  // ← ПОТОМ сигнал
      * ==================================================================== */
-    msync(shared, MMAP_SIZE, MS_SYNC);       // Сбрасываем наш кэш в RAM
+    shm_release(ch->map, ch->map_size, ch->use_msync); // Сбрасываем наш кэш в RAM
 
     /* ====================================================================
      * СЕМАФОРЫ: Сигнализация родителю о завершении
@@ -368,12 +1826,574 @@ int main(int argc, char *argv[]) {
      * - Другие CPU не могут обращаться к этой кэш-линии
      * - Операция выглядит атомарной для всех CPU
      * ==================================================================== */
-    sem_post(sem_done);                      // Сигнализируем родителю
+    sem_post(ch->sem_done);                  // Сигнализируем родителю ("звонок")
+}
+
+/* ============================================================================
+ * ПОТОКИ ВНУТРИ ДОЧЕРНЕГО (--threads N)
+ *
+ * Вместо N процессов с N областями и N парами семафоров - один дочерний
+ * и N потоков над одним куском:
+ * - начало куска до первого '\n' и хвост после последнего разбираются
+ *   как обычно (там строки, склеиваемые через границу куска);
+ * - середина - только целые строки - делится на N частей по '\n',
+ *   каждый поток пишет "Sum: ..." в СВОЙ буфер (без общих записей);
+ * - длины буферов складываются префиксными суммами - это смещения
+ *   частей в out[], и части копируются туда по порядку, так что вывод
+ *   совпадает с однопоточным байт в байт.
+ * Поток 0 - сам main(); остальные ждут на барьере pool.start между кусками.
+ * ============================================================================ */
+
+#define PAR_MIN 4096                         // Меньше байт на поток - дешевле разобрать одному
+
+/* Part - часть куска для одного потока и её результат */
+typedef struct {
+    const char *data;                        // Начало куска (смещения индекса - от него)
+    size_t from;                             // Смещение первой строки части
+    const uint32_t *nl;                      // Концы её строк в индексе куска (lidx.end)
+    size_t n;                                // Строк в части
+    char *buf;                               // Свой буфер "Sum: ..." (растёт по мере надобности)
+    size_t len, cap;
+    unsigned long lines;
+    PhaseStats st;                           // Свои c_parse/c_format (detail), складываются после
+    ParseState ps;                           // Своё состояние разбора (маски)
+} Part;
+
+static CHILD_LOCAL struct {
+    int n;                                   // Потоков, включая main() (1 - без пула)
+    int detail;                              // Построчные замеры для текущего куска
+    int quit;                                // Завершить потоки
+    pthread_barrier_t start, done;           // Начало и конец обработки куска
+    pthread_t tid[CHILD_THREADS_MAX];
+    Part part[CHILD_THREADS_MAX];
+} pool;
+
+/* part_run - разобрать все строки части в её буфер (как основной цикл main) */
+static void part_run(Part *p) {
+    size_t from = p->from;
+
+    p->len = 0;
+    p->lines = 0;
+    p->st.c_parse = p->st.c_format = 0;
+    for (size_t k = 0; k < p->n; k++) {
+        const char *s = p->data + from;
+        size_t len = p->nl[k] - from;
+        from = p->nl[k] + 1;
+        if (len > 0) {                       // Пустые строки пропускаются, как в main
+            if (p->len + result_max > p->cap) {
+                p->cap = p->cap ? 2 * p->cap : SHM_CAP_DEFAULT;
+                p->buf = realloc(p->buf, p->cap);
+                if (!p->buf) {
+                    safe_write(STDERR_FILENO, "Out of memory\n", 14);
+                    _exit(1);
+                }
+            }
+            p->len += put_result(p->buf + p->len, &p->ps, s, len, &p->st, pool.detail); // Прямо в куске, s[len] = '\n'
+            p->lines++;
+        }
+    }
+}
+
+/* pool_thread - поток i > 0: часть куска по сигналу барьера */
+static void *pool_thread(void *arg) {
+    Part *p = arg;
+
+    for (;;) {
+        pthread_barrier_wait(&pool.start);   // Барьер - ещё и барьер памяти: part[] уже заполнен
+        if (pool.quit) return NULL;
+        part_run(p);
+        pthread_barrier_wait(&pool.done);
+    }
+}
+
+/* pool_init - запустить n - 1 потоков (n <= 1 - пул не нужен) */
+static void pool_init(int n) {
+    if (n <= 1) return;
+    pthread_barrier_init(&pool.start, NULL, (unsigned)n);
+    pthread_barrier_init(&pool.done, NULL, (unsigned)n);
+    pool.n = n;
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&pool.tid[i], NULL, pool_thread, &pool.part[i]) != 0) {
+            safe_write(STDERR_FILENO, "pthread_create failed in child\n", 31);
+            _exit(1);
+        }
+    }
+}
+
+/* pool_stop - дождаться завершения потоков */
+static void pool_stop(void) {
+    if (pool.n <= 1) return;
+    pool.quit = 1;
+    pthread_barrier_wait(&pool.start);
+    for (int i = 1; i < pool.n; i++) {
+        pthread_join(pool.tid[i], NULL);
+        free(pool.part[i].buf);
+        parse_free(&pool.part[i].ps);
+    }
+    free(pool.part[0].buf);
+    parse_free(&pool.part[0].ps);
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+}
+
+/*
+ * pool_run - разобрать строки nl[0..n) куска data всеми потоками
+ *
+ * Первая строка начинается со смещения from. Части - примерно равные по
+ * байтам: граница ищется двоичным поиском по индексу строк.
+ * Результаты дописываются в out[] с позиции *out_pos; если не влезают,
+ * out[] отдаётся родителю через chan_more (строка "Sum: ..." при этом может
+ * разойтись на два вывода - склеенный поток байт тот же).
+ * Возвращает число обработанных строк.
+ */
+static unsigned long pool_run(Channel *ch, SharedData *slot, const char *data, size_t from, const uint32_t *nl,
+                              size_t lines_n, size_t *out_pos, PhaseStats *st, int detail) {
+    int n = pool.n;
+    size_t size = nl[lines_n - 1] + 1 - from; // Байт во всех строках
+    size_t k = 0;                            // Первая строка очередной части
+
+    for (int i = 0; i < n; i++) {            // Границы частей: ~size / n, сдвинутые к концу строки
+        size_t stop = lines_n;
+        if (i + 1 < n) {
+            size_t mark = from + size / (size_t)n * (size_t)(i + 1);
+            size_t lo = k, hi = lines_n;     // Первая строка, кончающаяся не раньше mark
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (nl[mid] < mark) lo = mid + 1;
+                else hi = mid;
+            }
+            stop = lo < lines_n ? lo + 1 : lines_n;
+        }
+        pool.part[i].data = data;
+        pool.part[i].from = k ? nl[k - 1] + 1 : from;
+        pool.part[i].nl = nl + k;
+        pool.part[i].n = stop - k;
+        k = stop;
+    }
+    pool.detail = detail;
+
+    pthread_barrier_wait(&pool.start);
+    part_run(&pool.part[0]);
+    pthread_barrier_wait(&pool.done);
+    if (atomic_load_explicit(&input_error, memory_order_relaxed)) return 0; // --server: кусок не выводится
+
+    /* Префиксные суммы длин - смещения частей в общем выводе */
+    char *out = slot_out(ch->rs, slot);
+    size_t out_cap = ch->rs->out_cap;
+    size_t off[CHILD_THREADS_MAX + 1];
+    unsigned long lines = 0;
+    off[0] = 0;
+    for (int i = 0; i < n; i++) {
+        off[i + 1] = off[i] + pool.part[i].len;
+        lines += pool.part[i].lines;
+        st->c_parse += pool.part[i].st.c_parse;
+        st->c_format += pool.part[i].st.c_format;
+    }
+
+    if (*out_pos + off[n] <= out_cap) {      // Обычно всё влезает: часть i - ровно по смещению off[i]
+        for (int i = 0; i < n; i++) memcpy(out + *out_pos + off[i], pool.part[i].buf, pool.part[i].len);
+        *out_pos += off[n];
+        return lines;
+    }
+
+    for (int i = 0; i < n; i++) {            // Не влезает - по порядку, отдавая out[] по мере заполнения
+        size_t done = 0, len = off[i + 1] - off[i];
+        while (done < len) {
+            if (*out_pos == out_cap) {       // out[] полон - отдаём родителю
+                chan_more(ch, slot, *out_pos);
+                *out_pos = 0;
+            }
+            size_t k = len - done < out_cap - *out_pos ? len - done : out_cap - *out_pos;
+            memcpy(out + *out_pos, pool.part[i].buf + done, k);
+            *out_pos += k;
+            done += k;
+        }
+    }
+    return lines;
+}
+
+/*
+ * sum_rows - двоичный вход: "Sum: ..." для строк [in_off, in_off + in_size)
+ *
+ * Числа читаются прямо из отображённого файла, без копирования и разбора.
+ * Индекс проверяется построчно: испорченный файл не должен увести чтение
+ * за пределы отображения. Возвращает заполненную часть out[];
+ * *bytes - сколько байт чисел просуммировано.
+ */
+static size_t sum_rows(Channel *ch, SharedData *slot, const BinHeader *bin, const char *input,
+                       PhaseStats *st, int detail, size_t *bytes) {
+    if (!bin || slot->in_off > bin->rows || slot->in_size > bin->rows - slot->in_off) {
+        safe_write(STDERR_FILENO, "Bad binary range\n", 17);
+        _exit(1);
+    }
+
+    const uint64_t *index = (const uint64_t *)(input + bin->index_off);
+    const char *data = input + bin->data_off;
+    char *out = slot_out(ch->rs, slot);
+    size_t out_pos = 0;
+
+    for (size_t r = slot->in_off; r < slot->in_off + slot->in_size; r++) {
+        uint64_t a = index[r], b = index[r + 1];
+        if (a > b || b > bin->values) {
+            safe_write(STDERR_FILENO, "Bad binary index\n", 17);
+            _exit(1);
+        }
+        if (out_pos + RESULT_MAX > ch->rs->out_cap) { // В out[] может не хватить места
+            chan_more(ch, slot, out_pos);
+            out_pos = 0;
+        }
+
+        unsigned long t0 = detail ? stat_ticks() : 0;
+        double sum = (bin->value_size == 4) ? sum_f32((const float *)data + a, (size_t)(b - a))
+                                            : sum_f64((const double *)data + a, (size_t)(b - a));
+        unsigned long t1 = detail ? stat_ticks() : 0;
+        if (bin->value_size == 4) sum = (float)sum; // float32 - и результат float, как у текста
+        out_pos += (size_t)write_float_to_buffer(out + out_pos, sum);
+        if (detail) {                        // Суммирование считается "разбором"
+            st->c_parse += t1 - t0;
+            st->c_format += stat_ticks() - t1;
+        }
+        *bytes += (size_t)(b - a) * bin->value_size;
+    }
+    return out_pos;
+}
+
+int main(int argc, char *argv[]) {
+    Channel ch = {0};                        // Транспорт обмена с родителем
+    int argi = 1;                            // Первый позиционный аргумент
+    int mmap_fd = -1;                        // --fd N: унаследованный memfd
+    int server = 0;                          // --server: не завершаться после SHM_EOF (демон)
+    int input_fd = -1;                       // --input N: дескриптор входного файла (--zero-copy)
+    int threads = 1;                         // --threads N: потоков на кусок
+
+    static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+    pthread_once(&simd_once, simd_init);     // Выбор AVX2/SSE2/скалярной классификации (один раз и при --inproc)
+
+    /* === ОПЦИИ (их передаёт родитель) === */
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--ring") == 0) { // Транспорт: кольцо слотов вместо семафоров
+            ch.ring = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--fd") == 0 && argi + 1 < argc) { // Бэкенд memfd
+            mmap_fd = atoi(argv[argi + 1]);  // atoi() - строка в int
+            argi += 2;
+        } else if (strcmp(argv[argi], "--input") == 0 && argi + 1 < argc) { // Родитель в режиме --zero-copy
+            input_fd = atoi(argv[argi + 1]);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--server") == 0) { // Режим демона: файл за файлом до SHM_QUIT
+            server = 1;
+            server_mode = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--threads") == 0 && argi + 1 < argc) { // Потоков на кусок
+            threads = atoi(argv[argi + 1]);
+            if (threads < 1 || threads > CHILD_THREADS_MAX) threads = 1; // Родитель уже проверил
+            argi += 2;
+        } else if (strcmp(argv[argi], "--agg") == 0 && argi + 1 < argc) { // Агрегаты строки
+            agg_mask = agg_parse(argv[argi + 1]);
+            if (agg_mask == 0) agg_mask = AGG_SUM; // Родитель уже проверил
+            argi += 2;
+        } else if (strcmp(argv[argi], "--columns") == 0) { // Агрегаты - колонками через '\t'
+            agg_columns = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--decimal") == 0) { // Точная сумма в фиксированной точке
+            dec_mode = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--precision") == 0 && argi + 1 < argc) { // Формат результата
+            if (strcmp(argv[argi + 1], "shortest") == 0) {
+                fmt_precision = FMT_SHORTEST;
+            } else {
+                fmt_precision = atoi(argv[argi + 1]);
+                if (fmt_precision < 0 || fmt_precision > FMT_PREC_MAX) fmt_precision = 2; // Родитель уже проверил
+            }
+            argi += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (dec_mode && fmt_precision == FMT_SHORTEST) fmt_precision = 2; // Родитель уже проверил
+    if (agg_mask != AGG_SUM) result_max = AGG_KINDS * AGG_FIELD_MAX + 1; // Поля агрегатов вместо одной суммы
+
+    if (mmap_fd < 0 && argc - argi < 1) {    // Нужен либо --fd, либо путь к mmap-файлу
+        safe_write(STDERR_FILENO, "Usage: child [--ring] [--server] [--input N] [--threads N] [--agg LIST] [--columns] [--decimal] [--precision N|shortest] [--fd N | <mmap_file>] [sem_ready sem_done]\n", 165);
+        return 1;
+    }
+
+    const char *mmap_file = (mmap_fd < 0) ? argv[argi++] : NULL;
+    ch.nslots = ch.ring ? RING_SLOTS : SHM_BUFFERS;
+    ch.use_msync = (mmap_fd < 0);            // msync нужен только файловому бэкенду
+
+    /* В режиме -j N у каждого дочернего своя пара семафоров - имена в argv */
+    const char *sem_ready_name = (argc - argi >= 2) ? argv[argi] : SEM_READY;
+    const char *sem_done_name = (argc - argi >= 2) ? argv[argi + 1] : SEM_DONE;
+
+    ch.sem_ready = SEM_FAILED;
+    ch.sem_done = SEM_FAILED;
+
+    /* ====================================================================
+     * MMAP: Открытие файла
+     * 
+     * mmap_file содержит путь "/tmp/os_lab3_mmap" (бэкенд file)
+     * Родитель уже создал и расширил (ftruncate) этот файл
+     * С --fd N (бэкенд memfd) открывать нечего: дескриптор унаследован
+     * ==================================================================== */
+#ifndef CHILD_EMBED
+    if (server) signal(SIGINT, SIG_IGN);     // Ctrl+C в терминале демона: завершением управляет родитель
+
+    /* Родитель убит (SIGKILL, OOM) - SHM_QUIT не придёт никогда, и дочерний
+     * (особенно --server демона) вечно ждал бы кусок в sem_wait/futex.
+     * Ядро пришлёт SIGTERM, когда родитель завершится; если он успел
+     * завершиться ещё до prctl, нас уже усыновил другой процесс. */
+    pid_t parent = getppid();
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent) return 1;
+#endif
+
+    if (mmap_file) mmap_fd = open(mmap_file, O_RDWR); // O_RDWR нужен для mmap с PROT_WRITE; memfd уже открыт
+    if (mmap_fd < 0) {                       // Ошибка: файл не найден или нет прав
+        safe_write(STDERR_FILENO, "Cannot open mmap file\n", 22);
+        return 1;
+    }
+
+    /* ====================================================================
+     * MMAP: Отображение в память дочернего процесса
+     * 
+     * КРИТИЧНО: параметры mmap ДОЛЖНЫ совпадать с parent.c!
+     * - Размер: текущий размер файла (fstat) - родитель выбрал его по
+     *   --buf и транспорту, заголовок RingShared описывает раскладку
+     * - Права: PROT_READ | PROT_WRITE
+     * - Флаги: MAP_SHARED (обязательно!)
+     * 
+     * Виртуальный адрес может отличаться от родителя:
+     * - Родитель: shared = 0x40000000
+     * - Дочерний: shared = 0x50000000
+     * НО физическая страница ОДНА (благодаря MAP_SHARED + один файл)
+     * 
+     * Как ядро связывает два процесса:
+     * 1. Родитель: mmap() → VMA → Page Table Entry → inode (файл)
+     * 2. Дочерний: mmap() → VMA → Page Table Entry → тот же inode
+     * 3. Kernel видит что оба процесса отображают один inode с MAP_SHARED
+     * 4. Выделяет ОДНУ физическую страницу для обоих
+     * 5. Оба PTE указывают на одну физическую страницу
+     * ==================================================================== */
+    struct stat map_st;
+    size_t map_size = fstat(mmap_fd, &map_st) == 0 ? (size_t)map_st.st_size : 0;
+    void *map = mmap(                        // Параметры идентичны parent.c
+        NULL,                                // ОС выбирает адрес
+        map_size ? map_size : SHM_PAGE,      // SHM_REGION_SIZE(nslots, cap)
+        PROT_READ | PROT_WRITE,              // Чтение + запись
+        MAP_SHARED | SHM_POPULATE(map_size), // КРИТИЧНО для IPC! (+ страницы сразу, если область большая)
+        mmap_fd,                             // Дескриптор файла
+        0                                    // Смещение 0 (с начала)
+    );
+    
+    if (map == MAP_FAILED) {                 // MAP_FAILED = (void*)-1
+        safe_write(STDERR_FILENO, "mmap error in child\n", 20);
+        close(mmap_fd);
+        return 1;
+    }
+
+    close(mmap_fd);                          // Дескриптор больше не нужен (отображение активно)
+
+    if (shm_check(map, map_size) < 0 || ((RingShared *)map)->nslots != (uint32_t)ch.nslots) {
+        safe_write(STDERR_FILENO, "Bad shared region\n", 18); // Другая версия протокола или не та область
+        return 1;
+    }
+    shm_advise(map, map_size, 0);
+
+    ch.map = map;
+    ch.map_size = map_size;
+    ch.rs = map;
+    shm_msync_ticks = &ch.rs->stats.c_msync; // msync - в счётчик дочерней стороны
+
+    ch.pshared = !ch.ring && ch.rs->sync == SHM_SYNC_PSHARED; // Родитель записал, где семафоры
+    if (ch.pshared) {                        // --sem pshared: семафоры - поля области, открывать нечего
+        chan_bind_sems(&ch);
+    } else if (!ch.ring) {                   // --ring обходится без семафоров
+        /* ====================================================================
+         * СЕМАФОРЫ: Открытие существующих семафоров
+         * 
+         * sem_open() без O_CREAT открывает СУЩЕСТВУЮЩИЙ семафор
+         * Родитель должен был создать его раньше!
+         * 
+         * Семафоры хранятся в /dev/shm/ (tmpfs в RAM)
+         * Проверить: ls -la /dev/shm/sem.os_lab3*
+         * ==================================================================== */
+        ch.sem_ready = sem_open(sem_ready_name, 0); // 0 = нет флагов (только открыть, не создавать)
+        if (ch.sem_ready == SEM_FAILED) {    // SEM_FAILED = ошибка (семафор не существует или нет прав)
+            safe_write(STDERR_FILENO, "sem_open ready failed in child\n", 31);
+            return 1;
+        }
+
+        ch.sem_done = sem_open(sem_done_name, 0); // Открываем второй семафор
+        if (ch.sem_done == SEM_FAILED) {
+            safe_write(STDERR_FILENO, "sem_open done failed in child\n", 30);
+            sem_close(ch.sem_ready);         // Закрываем первый при ошибке
+            return 1;
+        }
+    }
+
+    /* ====================================================================
+     * --zero-copy: собственное отображение входного файла
+     *
+     * PROT_READ + MAP_SHARED: страницы Page Cache отображаются как есть,
+     * без копирования в буфер. MADV_SEQUENTIAL - файл читается подряд:
+     * ядро читает вперёд крупнее и раньше освобождает пройденные страницы.
+     * Куски приходят как диапазоны [in_off, in_off + in_size) (SHM_RANGE).
+     *
+     * За файлом - сторожевая страница нулей (анонимное отображение, поверх
+     * начала которого MAP_FIXED кладётся файл): разбор на месте читает до
+     * LINE_PAD байт за концом строки, и за последней строкой файла это не
+     * должно попадать в неотображённую память.
+     * ==================================================================== */
+    const char *input = NULL;                // Отображение входного файла
+    size_t input_size = 0;
+    size_t input_map = 0;                    // Файл + сторожевая страница
+    if (input_fd >= 0) {
+        struct stat st;
+        if (fstat(input_fd, &st) == 0 && st.st_size > 0) {
+            input_size = (size_t)st.st_size;
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            input_map = (input_size + page - 1) / page * page + page;
+            void *m = mmap(NULL, input_map, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m != MAP_FAILED && mmap(m, input_size, PROT_READ, MAP_SHARED | MAP_FIXED, input_fd, 0) == MAP_FAILED) {
+                munmap(m, input_map);
+                m = MAP_FAILED;
+            }
+            if (m == MAP_FAILED) {
+                safe_write(STDERR_FILENO, "input mmap error in child\n", 26);
+                return 1;
+            }
+            madvise(m, input_size, MADV_SEQUENTIAL); // Подсказка, ошибка не критична
+            input = m;
+        }
+        close(input_fd);                     // Отображение живёт без дескриптора
+    }
+    const BinHeader *bin = bin_check(input, input_size); // Двоичный вход (txt2bin) или NULL
+    pool_init(threads);                      // --threads: потоки 1..N-1 ждут первый кусок
+
+    /* ====================================================================
+     * ПОТОКОВАЯ ОБРАБОТКА
+     *
+     * Родитель передаёт файл кусками (см. протокол в common.h).
+     * Кусок сначала индексируется (index_lines: смещения всех '\n'), затем
+     * строки разбираются прямо в куске, от границы до границы.
+     * ps (ParseState) живёт ВНЕ цикла по кускам: строка, начатая в конце
+     * одного куска, продолжается в следующем (line_feed/line_end) - любой длины.
+     * Результаты пишутся прямо в out[] слота (без промежуточного буфера).
+     *
+     * С --server (демон) SHM_EOF означает конец ОДНОГО файла клиента:
+     * хвост строки сбрасывается, и дочерний ждёт следующий файл.
+     * Выход - только по SHM_QUIT (на него дочерний не отвечает). Ошибка
+     * разбора (parse_fail) не завершает воркера: кусок с ней отвечает
+     * SHM_FAILED и сообщением в out[] вместо результатов, а состояние
+     * разбора сбрасывается. Остаток файла родитель не выводит (и не шлёт).
+     * ==================================================================== */
+    ParseState ps = {0};                     // Разбор строки (переживает границы кусков)
+    int eof = 0;                             // Родитель прислал последний кусок
+
+    while (!eof) {
+        SharedData *shared = chan_next(&ch); // Ждём очередной кусок
+
+        if (shared->flags & SHM_QUIT) break; // Демон останавливается
+
+        /* === ОБРАБОТКА КУСКА === */
+        PhaseStats *st = &ch.rs->stats;
+        unsigned long t_chunk = stat_ticks();
+        unsigned long idle0 = st->c_wait + st->c_msync; // Ожидание внутри куска (chan_more) - не обработка
+        int detail = atomic_load_explicit(&st->detail, memory_order_relaxed) != 0; // Включают --stats или lab3stat
+        unsigned long lines = 0;
+        eof = (shared->flags & SHM_EOF) != 0;
+        size_t out_pos = 0;                  // Текущая позиция в out[]
+        char *out = slot_out(ch.rs, shared); // Область не двигается, пока слот занят
+        size_t out_cap = ch.rs->out_cap;
+        const char *data = slot_in(ch.rs, shared); // Байты куска: in[] или диапазон отображённого файла
+        size_t data_size = shared->in_size;
+        size_t bin_bytes = 0;                // Двоичный вход: байт чисел в куске
+
+        if (shared->flags & SHM_BINARY) {    // Двоичный вход: in_off/in_size - диапазон строк
+            out_pos = sum_rows(&ch, shared, bin, input, st, detail, &bin_bytes);
+            lines = shared->in_size;
+            data_size = 0;                   // Текстового прохода ниже для этого куска нет
+        } else if (shared->flags & SHM_RANGE) { // --zero-copy: кусок прямо в Page Cache
+            if (!input || shared->in_off > input_size || data_size > input_size - shared->in_off) {
+                safe_write(STDERR_FILENO, "Bad input range\n", 16);
+                _exit(1);
+            }
+            data = input + shared->in_off;
+        }
+
+        size_t nl_count = data_size ? index_lines(data, data_size) : 0; // Концы строк куска - в lidx.end[]
+        size_t pos = 0;                      // Начало текущей строки в куске
+
+        for (size_t k = 0; k < nl_count; k++) { // Строка за строкой по индексу
+            /* --threads: начиная со второй строки (первая дописывает хвост прошлого куска) - пулу */
+            if (k == 1 && pool.n > 1 && lidx.end[nl_count - 1] - pos >= PAR_MIN * (size_t)pool.n) {
+                lines += pool_run(&ch, shared, data, pos, lidx.end + 1, nl_count - 1, &out_pos, st, detail);
+                pos = lidx.end[nl_count - 1] + 1;
+                break;                       // Дальше - хвост куска, как обычно
+            }
+
+            size_t len = lidx.end[k] - pos;  // Строка data[pos..pos + len) (или её продолжение), data[pos + len] = '\n'
+            const char *p = data + pos;
+            pos = lidx.end[k] + 1;
+
+            if (len > 0 || ps.open) {        // Есть что обработать (пустые строки пропускаются)
+                if (out_pos + result_max > out_cap) { // В out[] может не хватить места
+                    if (atomic_load_explicit(&input_error, memory_order_relaxed)) break; // Не отдавать результаты после ошибки
+                    chan_more(&ch, shared, out_pos);
+                    out_pos = 0;
+                }
+                out_pos += put_result(out + out_pos, &ps, p, len, st, detail); // Парсим на месте и форматируем
+                lines++;
+            }
+        }
+
+        if (pos < data_size) {               // Хвост без '\n' - начало строки следующего куска
+            unsigned long t0 = detail ? stat_ticks() : 0;
+            line_feed(&ps, data + pos, data_size - pos); // Целые токены - сейчас, последний - в ps.tok
+            if (detail) st->c_parse += stat_ticks() - t0;
+        }
+
+        const char *bad = atomic_load_explicit(&input_error, memory_order_relaxed);
+        if (eof && ps.open && !bad) {        // Последняя строка файла без '\n'
+            if (out_pos + result_max > out_cap) {
+                chan_more(&ch, shared, out_pos);
+                out_pos = 0;
+            }
+            out_pos += put_result(out + out_pos, &ps, NULL, 0, st, detail);
+            lines++;
+        }
+
+        st->c_busy += stat_ticks() - t_chunk - (st->c_wait + st->c_msync - idle0);
+        st->c_bytes += data_size + bin_bytes;
+        st->c_lines += lines;
+        if (!bad) bad = atomic_load_explicit(&input_error, memory_order_relaxed); // Последняя строка тоже могла
+        if (bad) {                           // --server: вместо результатов куска - сообщение об ошибке
+            out_pos = strlen(bad);
+            memcpy(out, bad, out_pos);
+            shared->flags |= SHM_FAILED;
+            parse_reset(&ps);                // Следующий кусок - с чистого листа (результаты файла родитель уже не выводит)
+            for (int i = 0; i < pool.n; i++) parse_reset(&pool.part[i].ps);
+            atomic_store_explicit(&input_error, NULL, memory_order_relaxed);
+        }
+        chan_done(&ch, shared, out_pos);     // Отдаём результат родителю
+
+        if (server) eof = 0;                 // Файл клиента закончился - ждём следующий (ps уже сброшен line_end)
+    }
 
     /* === ОЧИСТКА РЕСУРСОВ === */
-    munmap(shared, MMAP_SIZE);               // Отменяем отображение
-    sem_close(sem_ready);                    // Закрываем дескрипторы семафоров
-    sem_close(sem_done);                     // (sem_unlink делает родитель)
+    pool_stop();
+    parse_free(&ps);
+    free(lidx.end);                          // Индекс строк (при --inproc поток завершается, а процесс - нет)
+    lidx.end = NULL;
+    lidx.cap = 0;
+    munmap(ch.map, ch.map_size);             // Отменяем отображение
+    if (input) munmap((void *)input, input_map);
+    if (!ch.ring && !ch.pshared) {
+        sem_close(ch.sem_ready);             // Закрываем дескрипторы семафоров
+        sem_close(ch.sem_done);              // (sem_unlink делает родитель)
+    }
 
     return 0;                                // Успешное завершение
-}
\ No newline at end of file
+}
@@ -0,0 +1,551 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Общий протокол parent <-> child
+ *
+ * Описание: Константы, структура разделяемой памяти и вспомогательные
+ * функции, которые раньше дублировались вручную в parent.c и child.c.
+ * Теперь оба процесса подключают этот заголовок, и расхождение
+ * SharedData между ними невозможно.
+ * ============================================================================
+ */
+
+#ifndef OS_LAB3_COMMON_H
+#define OS_LAB3_COMMON_H
+
+#include <unistd.h>       // write(), ssize_t, syscall()
+#include <stddef.h>       // size_t
+#include <stdint.h>       // uint32_t, uint64_t (заголовок двоичного формата)
+#include <string.h>       // memcmp() (сигнатура двоичного формата), strcspn()
+#include <errno.h>        // errno, EINTR, ETIMEDOUT
+#include <limits.h>       // INT_MAX
+#include <stdatomic.h>    // _Atomic, atomic_load_explicit(), atomic_store_explicit(), memory_order_*
+#include <sys/mman.h>     // msync(), MS_SYNC
+#include <semaphore.h>    // sem_t, sem_wait(), sem_timedwait() (ожидание владения слотом)
+#include <sys/syscall.h>  // SYS_futex
+#include <linux/futex.h>  // FUTEX_WAIT, FUTEX_WAKE
+#include <time.h>         // clock_gettime() (статистика фаз, срок sem_timedwait)
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>    // __rdtsc() (статистика фаз)
+#endif
+
+/* === КОНСТАНТЫ === */
+#define MMAP_FILE "/tmp/os_lab3_mmap"       // Путь к файлу для mmap (в tmpfs = в RAM, быстро)
+#define SEM_READY "/os_lab3_sem_ready"      // Имя семафора "родитель сигнализирует: данные готовы"
+#define SEM_DONE "/os_lab3_sem_done"        // Имя семафора "дочерний сигнализирует: обработка завершена"
+#define SHM_LOCK "/os_lab3_lock"            // Демон: замок "пул занят клиентом" (flock) + PID демона и клиента
+#define SHM_NAME "/os_lab3_shm"             // Демон: имя POSIX shared memory (клиенты находят область по имени)
+#define IPC_TAG_SEP '-'                     // Обычный запуск: "<имя>-<PID родителя>[.i]" - свои имена у каждого экземпляра
+
+/* Ёмкость буферов in[]/out[] каждого слота - задаётся при запуске (parent --buf) и растёт сама */
+#define SHM_CAP_DEFAULT (32 * 1024)         // По умолчанию 32 КБ (как прежняя область 64 КБ на слот)
+#define SHM_CAP_MIN 4096                    // Меньше - out[] не вместит и пары результатов
+#define SHM_CAP_MAX (64 * 1024 * 1024)      // Предел роста: строка длиннее идёт "липкими" кусками
+#define SHM_HUGE_MIN (2 * 1024 * 1024)      // С этого размера области - MAP_POPULATE и MADV_HUGEPAGE
+#define SHM_MAGIC 0x334C534Fu               // "OSL3" - сигнатура разделяемой области
+#define SHM_VERSION 4u                      // Версия раскладки области (3 - без child_pid)
+
+#define MEMFD_NAME "os_lab3_shm"           // Имя memfd (видно только в /proc/<pid>/fd, в ФС не появляется)
+
+/* Бэкенд разделяемой памяти (parent --shm ...) */
+#define SHM_BACKEND_MEMFD 0                 // memfd_create(): анонимная память, fd наследуется через execv
+#define SHM_BACKEND_FILE  1                 // Файл MMAP_FILE + msync(MS_SYNC) вокруг каждого обмена
+#define SHM_BACKEND_POSIX 2                 // shm_open(SHM_NAME): как memfd, но с именем (демон и клиенты)
+
+/* Где живут семафоры ready/done (parent --sem ...), записано в RingShared.sync */
+#define SHM_SYNC_NAMED   0                  // sem_open(SEM_READY/SEM_DONE): объекты в /dev/shm, имена в argv
+#define SHM_SYNC_PSHARED 1                  // sem_init(pshared = 1) в самой области: ни имён, ни лишних отображений
+
+#define RESULT_MAX 64                       // Максимальная длина одной строки результата
+#define FMT_PREC_MAX 17                     // --precision: максимум знаков после точки (10^17 < 2^57)
+
+/* Самая длинная строка: "Sum: -" + 39 цифр FLT_MAX + '.' + FMT_PREC_MAX цифр + '\n' */
+_Static_assert(6 + 39 + 1 + FMT_PREC_MAX + 1 <= RESULT_MAX, "RESULT_MAX too small for FMT_PREC_MAX");
+
+/*
+ * Агрегаты строки (parent --agg sum,count,...): бит i - имя agg_parse()[i].
+ * Выводятся всегда в этом порядке, какой бы ни был порядок в списке.
+ */
+#define AGG_SUM   0x01u                     // Сумма (как без --agg)
+#define AGG_COUNT 0x02u                     // Число чисел
+#define AGG_MIN   0x04u
+#define AGG_MAX   0x08u
+#define AGG_MEAN  0x10u                     // Среднее
+#define AGG_VAR   0x20u                     // Дисперсия (генеральная: делится на count)
+#define AGG_KINDS 6
+#define AGG_FIELD_MAX (8 + 1 + 309 + 1 + FMT_PREC_MAX) // "Count: " + ' ' + самый длинный double с дробью
+
+/* agg_parse - список имён через запятую в маску AGG_* (0 - ошибка) */
+static inline unsigned agg_parse(const char *list) {
+    static const char *const names[AGG_KINDS] = {"sum", "count", "min", "max", "mean", "var"};
+    unsigned mask = 0;
+
+    for (const char *p = list;; p++) {
+        size_t len = strcspn(p, ",");
+        unsigned bit = 0;
+        for (int i = 0; i < AGG_KINDS; i++) {
+            if (strlen(names[i]) == len && memcmp(p, names[i], len) == 0) bit = 1u << i;
+        }
+        if (!bit) return 0;                  // Неизвестное или пустое имя
+        mask |= bit;
+        p += len;
+        if (*p == '\0') return mask;
+    }
+}
+
+#define RING_SLOTS 8                        // Слотов в кольце режима --ring (кусков "в полёте" на воркер)
+#define SHM_BUFFERS 2                       // Буферов в режиме семафоров (двойная буферизация)
+#define RING_SPIN 2000                      // Итераций активного ожидания перед futex_wait()
+#define SHM_ALIVE_MS 100                    // Родитель: как часто во время ожидания проверять, жив ли дочерний
+
+/* Флаги в SharedData.flags */
+#define SHM_EOF  0x1u                       // Родитель: это последний кусок входного файла
+#define SHM_MORE 0x2u                       // Дочерний: out[] заполнен, кусок обработан не до конца
+#define SHM_QUIT 0x4u                       // Родитель: завершить дочерний (режим --server), ответа не будет
+#define SHM_RANGE 0x8u                      // Родитель: кусок = [in_off, in_off + in_size) входного файла (--zero-copy)
+#define SHM_BINARY 0x10u                    // Вместе с SHM_RANGE: in_off/in_size - строки двоичного файла, а не байты
+#define SHM_FAILED 0x20u                    // Дочерний (--server): ошибка во входе, out[] - сообщение вместо результатов
+
+#define ZC_CHUNK (1024 * 1024)              // --zero-copy: примерный размер диапазона на один кусок
+#define BIN_ROW_OUT 16                      // Двоичный вход: строк на кусок = out_cap / 16 ("Sum: ..." обычно короче)
+#define CHILD_THREADS_MAX 64                // --threads: потоков в одном дочернем
+
+/* Состояния слота - флаг владения (SharedData.state) */
+#define SLOT_FREE  0u                       // Слот свободен, его заполняет родитель
+#define SLOT_READY 1u                       // Родитель: кусок в in[] готов к обработке
+#define SLOT_MORE  2u                       // Дочерний: out[] заполнен, ждём пока родитель его выведет
+#define SLOT_DONE  3u                       // Дочерний: кусок обработан целиком
+#define SLOT_DEAD  4u                       // Не состояние: ожидание прервано - другая сторона завершилась
+
+/*
+ * SharedData - структура данных в разделяемой памяти
+ *
+ * Потоковый протокол (вход любого размера при постоянной памяти):
+ * 1. Родитель читает очередной кусок файла в in[], выставляет in_size
+ *    и (для последнего куска) SHM_EOF, затем sem_post(ready).
+ * 2. Дочерний разбирает in[] и пишет результаты в out[]. Незаконченная
+ *    строка в конце куска НЕ теряется - дочерний хранит её у себя и
+ *    продолжает со следующим куском.
+ * 3. Если out[] переполняется, дочерний выставляет SHM_MORE и отдаёт
+ *    управление родителю; тот выводит out[] и снова делает sem_post(ready),
+ *    не меняя in[]. Без SHM_MORE - кусок обработан целиком.
+ *
+ * Буферов SharedData несколько (SHM_BUFFERS, с --ring - RING_SLOTS), и
+ * каждым в данный момент владеет ровно одна сторона - это записано в
+ * state (SLOT_*). Пока дочерний разбирает буфер A, родитель читает
+ * файл в буфер B. Подробнее - RingShared ниже.
+ *
+ * Сами in[]/out[] лежат не в SharedData, а в области данных за всеми
+ * слотами (slot_in()/slot_out()): их размер задаётся при запуске и может
+ * расти, а служебные поля слота остаются на месте - на них ждут futex и
+ * семафоры.
+ *
+ * С --zero-copy (SHM_RANGE) in[] не используется: дочерний сам отображает
+ * входной файл, а родитель передаёт только границы куска (in_off, in_size).
+ */
+typedef struct {
+    _Alignas(64) _Atomic unsigned state;    // SLOT_*: кто сейчас владеет буфером
+    unsigned flags;                         // SHM_EOF/SHM_QUIT (пишет родитель), SHM_MORE/SHM_FAILED (пишет дочерний)
+    size_t in_size;                         // Количество актуальных байт в in[] (или длина диапазона)
+    size_t in_off;                          // SHM_RANGE: смещение куска во входном файле
+    size_t out_size;                        // Количество актуальных байт в out[]
+} SharedData;
+
+_Static_assert(sizeof(SharedData) == 64, "SharedData header must be one cache line");
+
+/*
+ * BinHeader - двоичный колоночный формат входа (txt2bin)
+ *
+ * Тот же смысл, что у текста - строки чисел, сумма по строке, - но числа
+ * уже в двоичном виде и лежат одним массивом:
+ *
+ *   [BinHeader, 64 байта][числа: values штук float32/float64][индекс]
+ *
+ * Индекс - rows + 1 чисел uint64: строка r - это числа
+ * [index[r], index[r + 1]). Порядок байтов - родной (little-endian на x86).
+ * Массив чисел начинается с data_off (кратно 64 - удобно для SIMD),
+ * индекс - с index_off (кратно 8).
+ *
+ * Родитель узнаёт формат по сигнатуре BIN_MAGIC в начале файла, дочерние
+ * отображают файл сами (как --zero-copy) и получают диапазоны строк.
+ */
+#define BIN_MAGIC "OSL3COL1"                // Сигнатура: первые 8 байт файла
+#define BIN_MAGIC_LEN 8
+#define BIN_VERSION 1u
+
+typedef struct {
+    char magic[BIN_MAGIC_LEN];              // BIN_MAGIC
+    uint32_t version;                       // BIN_VERSION
+    uint32_t value_size;                    // 4 = float32, 8 = float64
+    uint64_t rows;                          // Строк
+    uint64_t values;                        // Чисел во всех строках
+    uint64_t data_off;                      // Смещение массива чисел
+    uint64_t index_off;                     // Смещение индекса (rows + 1 значений)
+    char pad[16];                           // До 64 байт
+} BinHeader;
+
+_Static_assert(sizeof(BinHeader) == 64, "BinHeader must be 64 bytes");
+
+/*
+ * bin_check - заголовок двоичного файла, если он целиком в пределах size
+ *
+ * Возвращает NULL, если это не двоичный формат или заголовок испорчен.
+ * Сам индекс (неубывание) проверяет дочерний построчно при суммировании.
+ */
+static inline const BinHeader *bin_check(const void *map, size_t size) {
+    const BinHeader *h = map;
+    if (!map || size < sizeof(BinHeader) || memcmp(h->magic, BIN_MAGIC, BIN_MAGIC_LEN) != 0) return NULL;
+    if (h->version != BIN_VERSION || (h->value_size != 4 && h->value_size != 8)) return NULL;
+    if (h->data_off % 64 || h->index_off % 8) return NULL;
+    if (h->data_off > size || h->values > (size - h->data_off) / h->value_size) return NULL;
+    if (h->index_off > size || h->rows >= (size - h->index_off) / 8) return NULL; // rows + 1 значений
+    return h;
+}
+
+/*
+ * PhaseStats - счётчики фаз обмена (parent --stats, lab3stat)
+ *
+ * Лежат в той же разделяемой области, что и слоты: родитель и дочерний
+ * копят их по ходу работы, а lab3stat подключается к области работающего
+ * parent и читает их "вживую". У каждого поля один писатель; поля
+ * родителя и дочернего - на разных кэш-линиях.
+ *
+ * Время - в тиках stat_ticks() (rdtsc на x86, иначе наносекунды).
+ * В наносекунды переводит читатель: t0_ticks/t0_ns записаны при создании
+ * области, отношение приращений даёт цену тика (stat_ns_per_tick).
+ *
+ * Время на кусок (чтение, ожидание, msync, обработка) меряется всегда -
+ * это пара rdtsc на 32 КБ. Разбивку обработки на разбор и форматирование
+ * дочерний делает построчно и только при detail = 1 (--stats или
+ * подключённый lab3stat): на коротких строках три rdtsc заметны.
+ * Ожидание считается без msync внутри него - msync учитывается отдельно.
+ */
+typedef struct {
+    _Alignas(64) unsigned long p_read;      // Родитель: read() входного файла
+    unsigned long p_write;                  // Родитель: вывод результатов в stdout
+    unsigned long p_msync;                  // Родитель: msync (только --shm file)
+    unsigned long p_wait;                   // Родитель: ожидание результата дочернего
+    unsigned long p_chunks;                 // Родитель: кусков отдано
+    _Alignas(64) unsigned long c_wait;      // Дочерний: ожидание куска от родителя
+    unsigned long c_msync;                  // Дочерний: msync (только --shm file)
+    unsigned long c_busy;                   // Дочерний: обработка кусков целиком
+    unsigned long c_parse;                  // Дочерний: process_line() (только detail)
+    unsigned long c_format;                 // Дочерний: write_float_to_buffer() (только detail)
+    unsigned long c_bytes;                  // Дочерний: байт обработано
+    unsigned long c_lines;                  // Дочерний: строк обработано
+    _Alignas(64) _Atomic unsigned detail;   // 1 = мерить разбор и форматирование построчно
+    unsigned long t0_ticks;                 // Отсчёт для перевода тиков в наносекунды
+    unsigned long t0_ns;
+} PhaseStats;
+
+/* stat_ns - монотонное время в наносекундах */
+static inline unsigned long stat_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/* stat_ticks - дешёвая метка времени для счётчиков фаз */
+static inline unsigned long stat_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return (unsigned long)__rdtsc();         // ~20 тактов, без системного вызова
+#else
+    return stat_ns();
+#endif
+}
+
+/* stat_init - начало отсчёта (родитель, при создании области) */
+static inline void stat_init(PhaseStats *st) {
+    st->t0_ns = stat_ns();
+    st->t0_ticks = stat_ticks();
+}
+
+/* stat_ns_per_tick - цена тика по двум парам (тики, нс): при создании и сейчас */
+static inline double stat_ns_per_tick(const PhaseStats *st) {
+    unsigned long dn = stat_ns() - st->t0_ns;
+    unsigned long dt = stat_ticks() - st->t0_ticks;
+    return dt ? (double)dn / (double)dt : 1.0;
+}
+
+/*
+ * RingShared - разделяемая область: управляющие поля + кольцо слотов
+ *
+ * Слоты - SharedData с флагом владения state (single-producer/single-consumer):
+ * - Родитель заполняет слоты по порядку и переводит их FREE -> READY,
+ *   не дожидаясь дочернего: до RING_SLOTS кусков "в полёте".
+ * - Дочерний обходит слоты в том же порядке, READY -> DONE (или MORE).
+ * - Родитель забирает результаты по порядку, DONE -> FREE.
+ *
+ * Видимость данных обеспечивают атомики C11: запись state с
+ * memory_order_release "публикует" всё, что записано в слот до неё,
+ * а чтение с memory_order_acquire гарантирует, что после него видны
+ * in[]/out[] другой стороны. Никаких msync и системных вызовов.
+ *
+ * Ожидание (--ring, RING_SLOTS слотов): сначала RING_SPIN итераций
+ * опроса (дешевле переключения контекста, если другая сторона вот-вот
+ * ответит), затем futex_wait() прямо на слове state. *_sleeping -
+ * счётчики спящих сторон: будящий делает futex_wake() только если кто-то
+ * действительно спит.
+ *
+ * Ожидание без --ring (SHM_BUFFERS слотов, двойная буферизация): семафоры
+ * ready/done - только "звонки", см. sem_wait_state() ниже. Они либо
+ * именованные (sync = SHM_SYNC_NAMED), либо лежат здесь же, в заголовке
+ * (SHM_SYNC_PSHARED): futex разделяемого отображения привязан к странице
+ * объекта, а не к адресу, поэтому такой семафор работает между процессами
+ * и переживает mremap у любой из сторон.
+ *
+ * Раскладка задаётся при запуске и описана в самой области: родитель
+ * пишет magic/version/ёмкости, дочерний (и клиент демона, и lab3stat)
+ * проверяет их, а не полагается на то, что собран с тем же MMAP_SIZE:
+ *
+ *   [RingShared + nslots SharedData][выравнивание до страницы]
+ *   [in[0] out[0]][in[1] out[1]]...   - по in_cap + out_cap байт на слот
+ *
+ * Рост (worker_grow в parent): только когда все слоты воркера FREE. Родитель
+ * делает ftruncate + mremap, записывает новые in_cap/out_cap/region_size и
+ * отдаёт следующий кусок; дочерний, получив слот (acquire), видит, что
+ * region_size больше его отображения, и сам делает mremap.
+ */
+typedef struct {
+    uint32_t magic;                                // SHM_MAGIC
+    uint32_t version;                              // SHM_VERSION
+    uint32_t nslots;                               // RING_SLOTS (--ring) или SHM_BUFFERS
+    uint32_t sync;                                 // SHM_SYNC_*: где семафоры ready/done
+    size_t in_cap, out_cap;                        // Ёмкости in[] и out[] каждого слота
+    size_t data_off;                               // Начало буферов (кратно странице)
+    size_t region_size;                            // Размер всей области (= размер файла/memfd)
+    sem_t sem_ready, sem_done;                     // SHM_SYNC_PSHARED: семафоры прямо в области
+    _Alignas(64) _Atomic unsigned parent_sleeping; // Родитель спит в futex_wait()
+    _Alignas(64) _Atomic unsigned child_sleeping;  // Дочерний спит в futex_wait()
+    unsigned long next_seq;                        // Демон: номер следующего слота (передаётся от клиента к клиенту)
+    pid_t child_pid;                               // PID дочернего (клиент демона проверяет, жив ли он); 0 - --inproc
+    _Alignas(64) unsigned long child_stalls;       // Сколько раз дочерний ждал родителя (его слот ещё не READY)
+    PhaseStats stats;                              // Счётчики фаз (--stats, lab3stat)
+    _Alignas(64) SharedData slot[];                // Кольцо слотов: RING_SLOTS (--ring) или SHM_BUFFERS
+} RingShared;
+
+#define SHM_PAGE 4096                                // Выравнивание области данных
+#define SHM_DATA_OFF(nslots) ((sizeof(RingShared) + (size_t)(nslots) * sizeof(SharedData) + SHM_PAGE - 1) & ~(size_t)(SHM_PAGE - 1))
+#define SHM_REGION_SIZE(nslots, cap) (SHM_DATA_OFF(nslots) + (size_t)(nslots) * 2 * (size_t)(cap)) // in[] и out[] по cap байт
+
+/* shm_init - записать раскладку в только что созданную (обнулённую) область */
+static inline void shm_init(RingShared *rs, unsigned nslots, size_t cap) {
+    rs->magic = SHM_MAGIC;
+    rs->version = SHM_VERSION;
+    rs->nslots = nslots;
+    rs->in_cap = rs->out_cap = cap;
+    rs->data_off = SHM_DATA_OFF(nslots);
+    rs->region_size = SHM_REGION_SIZE(nslots, cap);
+}
+
+/*
+ * shm_check - раскладка области корректна и помещается в size байт
+ *
+ * Возвращает 0 или -1 (чужая/испорченная область, другая версия протокола).
+ */
+static inline int shm_check(const RingShared *rs, size_t size) {
+    if (size < sizeof(RingShared) || rs->magic != SHM_MAGIC || rs->version != SHM_VERSION) return -1;
+    if (rs->nslots != RING_SLOTS && rs->nslots != SHM_BUFFERS) return -1;
+    if (rs->sync != SHM_SYNC_NAMED && rs->sync != SHM_SYNC_PSHARED) return -1;
+    if (rs->in_cap < SHM_CAP_MIN || rs->in_cap > SHM_CAP_MAX || rs->out_cap < SHM_CAP_MIN || rs->out_cap > SHM_CAP_MAX) return -1;
+    if (rs->data_off != SHM_DATA_OFF(rs->nslots)) return -1;
+    if (rs->region_size != rs->data_off + rs->nslots * (rs->in_cap + rs->out_cap) || rs->region_size > size) return -1;
+    return 0;
+}
+
+/* slot_in / slot_out - буферы слота в области данных */
+static inline char *slot_in(RingShared *rs, const SharedData *slot) {
+    return (char *)rs + rs->data_off + (size_t)(slot - rs->slot) * (rs->in_cap + rs->out_cap);
+}
+
+static inline char *slot_out(RingShared *rs, const SharedData *slot) {
+    return slot_in(rs, slot) + rs->in_cap;
+}
+
+#define SHM_POPULATE(size) ((size) >= SHM_HUGE_MIN ? MAP_POPULATE : 0) // Флаг mmap: подкачать страницы сразу
+
+/*
+ * shm_advise - большая область: попросить huge pages (меньше промахов TLB)
+ *
+ * grown = 1 - область только что выросла через mremap: у него нет
+ * MAP_POPULATE, поэтому новые страницы подкачиваются отдельно.
+ * Всё - подсказки: ошибки не мешают работе.
+ */
+static inline void shm_advise(void *map, size_t size, int grown) {
+    if (size < SHM_HUGE_MIN) return;
+    madvise(map, size, MADV_HUGEPAGE);       // tmpfs/memfd: только если разрешено в shmem_enabled
+#ifdef MADV_POPULATE_WRITE
+    if (grown) madvise(map, size, MADV_POPULATE_WRITE); // Linux 5.14+
+#else
+    (void)grown;
+#endif
+}
+
+/*
+ * safe_write - Надёжная запись данных в файловый дескриптор
+ *
+ * Зачем нужна: write() может записать МЕНЬШЕ чем count байт или быть прерван сигналом.
+ * safe_write гарантирует запись ВСЕХ байт.
+ */
+static inline ssize_t safe_write(int fd, const void *buf, size_t count) {
+    const char *p = buf;                     // Указатель на текущую позицию в буфере (для сдвига)
+    size_t left = count;                     // Счётчик оставшихся байт для записи
+
+    while (left > 0) {                       // Цикл пока есть незаписанные байты
+        ssize_t written = write(fd, p, left); // write() - системный вызов записи, возвращает количество записанных байт
+
+        if (written < 0) {                   // Ошибка записи (возвращено -1)
+            if (errno == EINTR) continue;    // EINTR = прерван сигналом (например SIGCHLD), повторить попытку
+            return -1;                       // Другая ошибка - выход с ошибкой
+        }
+
+        p += written;                        // Сдвинуть указатель на количество записанных байт
+        left -= written;                     // Уменьшить счётчик оставшихся байт
+    }
+
+    return count;                            // Успех: все байты записаны
+}
+
+/*
+ * shm_release / shm_acquire - видимость данных SharedData при обмене через семафоры
+ *
+ * use_msync = 1 (бэкенд file): исторический путь - msync(MS_SYNC) на всю
+ * область. На tmpfs это дорогой системный вызов, а на диске - ещё и
+ * принудительная запись страниц на накопитель.
+ *
+ * use_msync = 0 (бэкенд memfd): кэши процессоров когерентны аппаратно,
+ * а sem_post()/sem_wait() сами являются барьерами памяти. Явные
+ * atomic_thread_fence() документируют порядок: всё записанное ДО
+ * release-барьера видно другой стороне ПОСЛЕ её acquire-барьера.
+ * Ни одного системного вызова сверх sem_post/sem_wait.
+ */
+static _Thread_local unsigned long *shm_msync_ticks; // Куда копить время msync (PhaseStats своей стороны), NULL - никуда
+static _Thread_local int (*shm_peer_alive)(void *);  // Жива ли другая сторона (родитель), NULL - ждать без проверок
+static _Thread_local void *shm_peer;                 // Аргумент shm_peer_alive (воркер родителя)
+
+static inline void shm_msync(void *addr, size_t len) {
+    unsigned long t0 = stat_ticks();
+    msync(addr, len, MS_SYNC);
+    if (shm_msync_ticks) *shm_msync_ticks += stat_ticks() - t0;
+}
+
+static inline void shm_release(void *addr, size_t len, int use_msync) {
+    if (use_msync) shm_msync(addr, len);
+    else atomic_thread_fence(memory_order_release);
+}
+
+static inline void shm_acquire(void *addr, size_t len, int use_msync) {
+    if (use_msync) shm_msync(addr, len);
+    else atomic_thread_fence(memory_order_acquire);
+}
+
+/*
+ * sem_wait_state - дождаться state == a или b в режиме семафоров
+ *
+ * С несколькими буферами один sem_post() уже нельзя связать с конкретным
+ * буфером: пока дочерний ждёт продолжения буфера A (SHM_MORE), родитель
+ * мог отдать буфер B и тоже сделать sem_post(ready). Поэтому семафор -
+ * лишь "звонок" (что-то изменилось), а ответ на вопрос "чей буфер" даёт
+ * флаг владения state. Лишний звонок безвреден: проверили state, снова
+ * ждём. Звонок, "съеденный" при ожидании другого буфера, компенсируется
+ * тем, что следующий буфер окажется уже READY и ждать его не придётся.
+ *
+ * С shm_peer_alive звонок ждём не дольше SHM_ALIVE_MS: дочерний, упавший
+ * посреди куска (_exit на ошибке разбора), уже не позвонит. Тогда -
+ * SLOT_DEAD, если state так и не стал a или b.
+ * Возвращает прочитанное значение state (с семантикой acquire).
+ */
+static inline unsigned sem_wait_state(_Atomic unsigned *state, unsigned a, unsigned b, sem_t *bell,
+                                      void *addr, size_t len, int use_msync) {
+    for (int dead = 0;; ) {
+        shm_acquire(addr, len, use_msync);
+        unsigned s = atomic_load_explicit(state, memory_order_acquire);
+        if (s == a || s == b) return s;
+        if (dead) return SLOT_DEAD;          // Проверили state уже ПОСЛЕ смерти - ответа не будет
+        if (!shm_peer_alive) {
+            while (sem_wait(bell) < 0 && errno == EINTR) {} // Спим до следующего звонка
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SHM_ALIVE_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (sem_timedwait(bell, &deadline) < 0 && errno == ETIMEDOUT) dead = !shm_peer_alive(shm_peer);
+    }
+}
+
+/*
+ * sem_set_state - передать буфер другой стороне и "позвонить" ей
+ */
+static inline void sem_set_state(_Atomic unsigned *state, unsigned value, sem_t *bell,
+                                 void *addr, size_t len, int use_msync) {
+    atomic_store_explicit(state, value, memory_order_release); // release: данные буфера видны раньше state
+    shm_release(addr, len, use_msync);
+    sem_post(bell);
+}
+
+/* cpu_relax - подсказка процессору в цикле активного ожидания (x86: pause) */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * ring_wait - дождаться, пока слово state станет равно a или b
+ *
+ * Возвращает прочитанное значение (с семантикой acquire).
+ * sleeping - счётчик ЭТОЙ стороны (родителя или дочернего).
+ * С shm_peer_alive futex ждёт не дольше SHM_ALIVE_MS и, если другая
+ * сторона завершилась, не ответив, возвращается SLOT_DEAD.
+ */
+static inline unsigned ring_wait(_Atomic unsigned *state, unsigned a, unsigned b,
+                                 _Atomic unsigned *sleeping) {
+    unsigned s;
+
+    for (int i = 0; i < RING_SPIN; i++) {   // Фаза 1: короткий опрос без системных вызовов
+        s = atomic_load_explicit(state, memory_order_acquire);
+        if (s == a || s == b) return s;
+        cpu_relax();
+    }
+
+    struct timespec period = {SHM_ALIVE_MS / 1000, (SHM_ALIVE_MS % 1000) * 1000000L};
+    for (;;) {                               // Фаза 2: сон в ядре до futex_wake()
+        int timed_out = 0;
+        atomic_fetch_add_explicit(sleeping, 1, memory_order_seq_cst); // Объявляем, что засыпаем
+        s = atomic_load_explicit(state, memory_order_seq_cst); // Перепроверка ПОСЛЕ объявления
+        if (s != a && s != b) {
+            /* FUTEX_WAIT заснёт только если *state всё ещё == s (иначе сразу EAGAIN) */
+            timed_out = syscall(SYS_futex, (unsigned *)state, FUTEX_WAIT, s, shm_peer_alive ? &period : NULL,
+                                NULL, 0) < 0 && errno == ETIMEDOUT;
+        }
+        atomic_fetch_sub_explicit(sleeping, 1, memory_order_relaxed);
+
+        s = atomic_load_explicit(state, memory_order_acquire);
+        if (s == a || s == b) return s;
+        if (timed_out && !shm_peer_alive(shm_peer)) { // Завершилась - state уже окончательный
+            s = atomic_load_explicit(state, memory_order_acquire);
+            return s == a || s == b ? s : SLOT_DEAD;
+        }
+    }
+}
+
+/*
+ * ring_set - опубликовать новое состояние слота и разбудить другую сторону
+ *
+ * peer_sleeping - счётчик ДРУГОЙ стороны. Порядок "store state, затем
+ * load sleeping" (оба seq_cst) в паре с "inc sleeping, затем load state"
+ * в ring_wait() исключает потерянное пробуждение.
+ */
+static inline void ring_set(_Atomic unsigned *state, unsigned value, _Atomic unsigned *peer_sleeping) {
+    atomic_store_explicit(state, value, memory_order_seq_cst); // seq_cst включает release
+    if (atomic_load_explicit(peer_sleeping, memory_order_seq_cst) > 0) {
+        syscall(SYS_futex, (unsigned *)state, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+#endif /* OS_LAB3_COMMON_H */
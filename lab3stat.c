@@ -0,0 +1,190 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Живая статистика работающего parent (lab3stat)
+ *
+ * Подключается к разделяемым областям воркеров уже запущенного parent
+ * и раз в интервал печатает скорость и то, на что уходит время
+ * (счётчики PhaseStats, см. common.h).
+ *
+ * Как находятся области: в /proc/PID/fd родителя ищутся дескрипторы
+ * memfd "os_lab3_shm", /dev/shm/os_lab3_shm* (демон) или /tmp/os_lab3_mmap*
+ * (--shm file), и каждый открывается заново через /proc/PID/fd/N - так
+ * доступна даже анонимная memfd. Отображается только заголовок RingShared,
+ * область узнаётся по его магическому числу и версии (shm_check).
+ *
+ * Пока lab3stat подключён, дочерние меряют разбор и форматирование
+ * построчно (stats.detail = 1); при выходе флаг возвращается как был.
+ *
+ * Запуск: lab3stat PID [interval_ms]
+ *
+ * Вспомогательный инструмент, не часть лабораторной: printf() допустим.
+ * ============================================================================
+ */
+
+#define _GNU_SOURCE                          // syscall() в common.h (futex режима --ring)
+#define _POSIX_C_SOURCE 200809L              // Включает POSIX.1-2008 стандарт
+#define _XOPEN_SOURCE 700                    // Включает X/Open 7 расширения
+
+#include <unistd.h>                          // readlink(), close()
+#include <fcntl.h>                           // open(), O_RDWR
+#include <dirent.h>                          // opendir(), readdir()
+#include <sys/mman.h>                        // mmap(), munmap()
+#include <sys/stat.h>                        // fstat()
+#include <signal.h>                          // sigaction()
+#include <stdio.h>                           // printf(), snprintf()
+#include <stdlib.h>                          // atoi(), strtoul()
+#include <string.h>                          // strstr(), memset()
+#include <time.h>                            // nanosleep()
+
+#include "common.h"                          // RingShared, PhaseStats, shm_check()
+
+#define MAX_REGIONS 256                      // Как MAX_WORKERS у parent
+
+/* Snapshot - сумма счётчиков всех воркеров в один момент */
+typedef struct {
+    unsigned long ns;                        // Момент снимка
+    PhaseStats sum;                          // Сумма полей (t0_*/detail не используются)
+} Snapshot;
+
+static volatile sig_atomic_t stop = 0;       // Ctrl+C: отключиться и вернуть detail
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+/* alive - процесс существует и ещё не зомби (kill(pid, 0) успешен и для зомби) */
+static int alive(int pid) {
+    char path[64], buf[256];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 0;
+    buf[len] = '\0';
+    const char *p = strrchr(buf, ')');       // "pid (comm) S ...": comm может содержать пробелы
+    return p && p[1] == ' ' && p[2] != 'Z';
+}
+
+/* take - снять и сложить счётчики всех областей */
+static void take(RingShared **rs, int n, Snapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap->ns = stat_ns();
+    for (int i = 0; i < n; i++) {
+        const PhaseStats *st = &rs[i]->stats;
+        snap->sum.p_read += st->p_read;
+        snap->sum.p_write += st->p_write;
+        snap->sum.p_msync += st->p_msync;
+        snap->sum.p_wait += st->p_wait;
+        snap->sum.p_chunks += st->p_chunks;
+        snap->sum.c_wait += st->c_wait;
+        snap->sum.c_msync += st->c_msync;
+        snap->sum.c_busy += st->c_busy;
+        snap->sum.c_parse += st->c_parse;
+        snap->sum.c_format += st->c_format;
+        snap->sum.c_bytes += st->c_bytes;
+        snap->sum.c_lines += st->c_lines;
+    }
+}
+
+/* pct - доля тиков от интервала в процентах */
+static double pct(unsigned long ticks, double ns_per_tick, double interval_ns) {
+    return interval_ns > 0 ? 100.0 * (double)ticks * ns_per_tick / interval_ns : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3 || atoi(argv[1]) <= 0) {
+        fprintf(stderr, "Usage: lab3stat PID [interval_ms]\n");
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    unsigned long interval_ms = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    if (interval_ms == 0) interval_ms = 1000;
+
+    /* === ПОИСК ОБЛАСТЕЙ В /proc/PID/fd === */
+    char dir_path[64];
+    snprintf(dir_path, sizeof(dir_path), "/proc/%d/fd", pid);
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        perror("lab3stat: opendir /proc/PID/fd");
+        return 1;
+    }
+
+    static RingShared *rs[MAX_REGIONS];
+    static unsigned old_detail[MAX_REGIONS];
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL && n < MAX_REGIONS) {
+        char fd_path[320], target[256];
+        snprintf(fd_path, sizeof(fd_path), "%s/%s", dir_path, de->d_name);
+        ssize_t len = readlink(fd_path, target, sizeof(target) - 1);
+        if (len <= 0) continue;
+        target[len] = '\0';
+        if (!strstr(target, MEMFD_NAME) && !strstr(target, MMAP_FILE)) continue; // SHM_NAME содержит MEMFD_NAME
+
+        int fd = open(fd_path, O_RDWR);
+        struct stat st;
+        if (fd < 0) continue;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(RingShared)) {
+            close(fd);                       // Не область воркера
+            continue;
+        }
+        void *map = mmap(NULL, sizeof(RingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); // Буферы не нужны
+        close(fd);
+        if (map == MAP_FAILED) continue;
+        if (shm_check(map, (size_t)st.st_size) < 0) { // Чужая область или другая версия протокола
+            munmap(map, sizeof(RingShared));
+            continue;
+        }
+        rs[n] = map;
+        old_detail[n] = atomic_exchange(&rs[n]->stats.detail, 1u); // Построчная разбивка, пока смотрим
+        n++;
+    }
+    closedir(dir);
+
+    if (n == 0) {
+        fprintf(stderr, "lab3stat: no os_lab3 regions in process %d\n", pid);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("lab3stat: process %d, %d worker(s), every %lu ms\n", pid, n, interval_ms);
+
+    /* === ЖИВЫЕ СКОРОСТИ: разность двух снимков === */
+    Snapshot prev, cur;
+    take(rs, n, &prev);
+    while (!stop && alive(pid)) {
+        struct timespec ts = {(time_t)(interval_ms / 1000), (long)(interval_ms % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+        take(rs, n, &cur);
+
+        double ns_per_tick = stat_ns_per_tick(&rs[0]->stats);
+        double dt = (double)(cur.ns - prev.ns);
+        double child_ns = dt * n;            // У дочерних - доля суммарного времени всех воркеров
+        const PhaseStats *a = &prev.sum, *b = &cur.sum;
+
+        printf("%8.2f MB/s %10.0f lines/s | parent: read %5.1f%% write %5.1f%% msync %5.1f%% wait %5.1f%%"
+               " | child: busy %5.1f%% (parse %5.1f%% format %5.1f%%) wait %5.1f%% msync %5.1f%%\n",
+               (double)(b->c_bytes - a->c_bytes) * 1e3 / dt, (double)(b->c_lines - a->c_lines) * 1e9 / dt,
+               pct(b->p_read - a->p_read, ns_per_tick, dt), pct(b->p_write - a->p_write, ns_per_tick, dt),
+               pct(b->p_msync - a->p_msync, ns_per_tick, dt), pct(b->p_wait - a->p_wait, ns_per_tick, dt),
+               pct(b->c_busy - a->c_busy, ns_per_tick, child_ns), pct(b->c_parse - a->c_parse, ns_per_tick, child_ns),
+               pct(b->c_format - a->c_format, ns_per_tick, child_ns), pct(b->c_wait - a->c_wait, ns_per_tick, child_ns),
+               pct(b->c_msync - a->c_msync, ns_per_tick, child_ns));
+        fflush(stdout);
+        prev = cur;
+    }
+
+    /* === ОТКЛЮЧЕНИЕ === */
+    for (int i = 0; i < n; i++) {
+        if (alive(pid)) atomic_store(&rs[i]->stats.detail, old_detail[i]);
+        munmap(rs[i], sizeof(RingShared));
+    }
+    return 0;
+}
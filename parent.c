@@ -4,86 +4,419 @@
  *
  *
  * 
- * Описание: Программа создаёт дочерний процесс и обменивается с ним данными
- * через memory-mapped файл. Синхронизация через POSIX семафоры.
+ * Описание: Программа создаёт дочерние процессы и обменивается с ними данными
+ * через memory-mapped файлы. Синхронизация через POSIX семафоры.
+ *
+ * Запуск: parent [-j N] [--threads N | --inproc] [--ring] [--shm memfd|file] [--sem named|pshared] [--buf N[K|M]]
+ *                [--zero-copy] [--stalls] [--stats] [--agg LIST] [--columns] [--decimal] [--precision N|shortest]
+ *                [--follow [FILE]]
+ *         parent [-j N] [--threads N | --inproc] [--ring] [--shm memfd|file] [--sem named|pshared] [--buf N[K|M]]
+ *                file1 file2 ... | --batch | --manifest FILE
+ *         parent --daemon [-j N] [--threads N] [--ring] [--sem named|pshared] [--buf N[K|M]]
+ *         parent --client
+ *   -j N     - пул из N дочерних процессов (по умолчанию 1)
+ *   --threads N - каждый дочерний делит кусок между N потоками (1..CHILD_THREADS_MAX)
+ *   --ring   - транспорт "кольцо слотов + атомики/futex" вместо семафоров
+ *   --shm    - бэкенд памяти: memfd (по умолчанию) или file (MMAP_FILE + msync)
+ *   --sem    - семафоры ready/done: named (sem_open, по умолчанию) или pshared
+ *              (sem_init прямо в разделяемой области - без объектов в /dev/shm)
+ *   --buf    - начальная ёмкость in[] и out[] каждого слота (4K..64M, по умолчанию 32K);
+ *              строка, не влезшая в in[], удваивает буферы всех воркеров
+ *   --inproc - "дочерние" - потоки этого процесса (child_main из child.c) над теми же
+ *              SharedData: без fork/exec, но и без изоляции (не с --threads/--daemon)
+ *   --daemon - долгоживущий пул: дочерние ждут файлы от клиентов (Ctrl+C/SIGTERM - остановка)
+ *   --client - отдать один файл работающему демону (без fork/exec/mmap-инициализации)
+ *   --zero-copy - дочерние сами отображают входной файл, родитель передаёт только границы кусков
+ *              (имя файла можно дать и аргументом: parent --zero-copy FILE - без вопроса об имени)
+ *   --stalls - в конце вывести в stderr, сколько раз каждая сторона простаивала в ожидании другой
+ *   --stats  - в конце вывести в stderr, на что ушло время (чтение, msync, ожидание, разбор,
+ *              форматирование), объёмы и простои; вживую те же счётчики показывает lab3stat PID
+ *   --batch  - пакет: имена файлов из stdin (по одному на строку); --manifest FILE - из файла;
+ *              имена можно перечислить и прямо в argv. Вывод каждого файла - после "==> имя <=="
+ *   --precision N|shortest - знаков после точки в "Sum: ..." (0..17, по умолчанию 2) или
+ *              кратчайшая запись, которая читается обратно в тот же float
+ *   --agg LIST - что выводить для строки: sum,count,min,max,mean,var (по умолчанию sum),
+ *              всё - за один проход по числам строки; --columns - значения через '\t' без подписей
+ *   --follow - не завершаться на конце файла: ждать (inotify) и разбирать только дописанные
+ *              строки, пока не придёт Ctrl+C/SIGTERM (только один текстовый файл, без --zero-copy)
+ *   --decimal - точная сумма: числа - целые int64 в единицах 10^-N (N = --precision),
+ *              без float и strtof; только записи вида [+-]цифры[.цифры]
+ *
+ * Дочерний (build/child) ищется рядом с самим parent (/proc/self/exe), а не
+ * в текущем каталоге, и запускается posix_spawn() (vfork: без копирования
+ * таблиц страниц родителя).
+ *
+ * Имена семафоров и mmap-файлов у каждого запуска свои ("<имя>-<PID>[.i]"),
+ * поэтому на одной машине могут работать сколько угодно экземпляров parent.
+ * Объекты упавших запусков удаляются при старте следующего (ipc_sweep).
+ * Демон и клиенты используют фиксированные имена - по ним клиент находит демона.
+ *
+ * Двоичный вход (txt2bin, см. BinHeader в common.h) распознаётся по сигнатуре
+ * сам: дочерние отображают файл и суммируют массивы чисел без разбора текста.
+ * Только для одного файла (не --batch/--client).
  * ============================================================================
  */
 
 /* Feature test macros - ДОЛЖНЫ быть ДО всех #include */
+#define _GNU_SOURCE              // syscall() для futex в режиме --ring, memfd_create(), memrchr()
 #define _POSIX_C_SOURCE 200809L  // Включает POSIX.1-2008 функции (sem_open, mmap и т.д.)
 #define _XOPEN_SOURCE 700        // Включает X/Open 7 расширения (для совместимости)
 
 /* === ЗАГОЛОВОЧНЫЕ ФАЙЛЫ === */
-#include <unistd.h>       // POSIX API: read(), write(), fork(), close(), execv(), _exit(), ftruncate()
-#include <fcntl.h>        // File control: open(), O_RDWR, O_CREAT, O_EXCL флаги
-#include <sys/mman.h>     // Memory management: mmap(), munmap(), msync(), MAP_SHARED, PROT_READ, PROT_WRITE
+#include <unistd.h>       // POSIX API: read(), write(), close(), readlink(), _exit(), ftruncate()
+#include <fcntl.h>        // File control: open(), fcntl(), O_RDWR, O_CREAT, O_EXCL флаги
+#include <sys/mman.h>     // Memory management: mmap(), munmap(), msync(), memfd_create(), MAP_SHARED, PROT_READ, PROT_WRITE
 #include <sys/types.h>    // Базовые типы: pid_t (ID процесса), size_t (размер), ssize_t (знаковый размер)
 #include <sys/wait.h>     // Ожидание процессов: wait(), waitpid(), макросы WIFEXITED и т.д.
 #include <sys/stat.h>     // Права доступа: S_IRUSR (user read), S_IWUSR (user write)
 #include <semaphore.h>    // POSIX семафоры: sem_t, sem_open(), sem_close(), sem_wait(), sem_post(), sem_unlink()
 #include <signal.h>       // Сигналы: kill(), SIGTERM (для аварийного завершения дочернего)
-#include <stdlib.h>       // Стандартная библиотека: _exit() (завершение без cleanup)
-#include <string.h>       // Строковые функции: strlen(), strchr(), memset()
-#include <errno.h>        // Коды ошибок: errno (глобальная переменная), EINTR, ERANGE
+#include <stdlib.h>       // Стандартная библиотека: _exit() (завершение без cleanup), strtol()
+#include <string.h>       // Строковые функции: strlen(), strchr(), memset(), memcpy(), strcmp()
+#include <errno.h>        // Коды ошибок: errno (глобальная переменная), EINTR, ERANGE, ETIMEDOUT
+#include <time.h>         // clock_gettime(), struct timespec (таймаут остановки демона)
+#include <dirent.h>       // opendir(), readdir(), dirfd() - поиск брошенных IPC-объектов
+#include <spawn.h>        // posix_spawn(), posix_spawn_file_actions_adddup2()
+#include <pthread.h>      // pthread_create(), pthread_join() (--inproc)
+#include <limits.h>       // PATH_MAX
+#include <sys/uio.h>      // writev(), struct iovec - вывод результатов пачками
+#include <sys/inotify.h>  // inotify_init1(), inotify_add_watch(), IN_MODIFY (--follow)
+#include <sys/signalfd.h> // signalfd() - SIGINT/SIGTERM как событие для poll() (--follow)
+#include <poll.h>         // poll(), struct pollfd
+#include <sys/file.h>     // flock() - замок пула демона
+
+#include "common.h"         // SharedData, RingShared, имена семафоров, safe_write()
 
 /* === КОНСТАНТЫ === */
 #define BUF_SIZE 256                        // Размер буфера для ввода имени файла (255 символов + '\0')
-#define MMAP_FILE "/tmp/os_lab3_mmap"       // Путь к файлу для mmap (в tmpfs = в RAM, быстро)
-#define SEM_READY "/os_lab3_sem_ready"      // Имя семафора "родитель сигнализирует: данные готовы"
-#define SEM_DONE "/os_lab3_sem_done"        // Имя семафора "дочерний сигнализирует: обработка завершена"
-#define MMAP_SIZE 8192                      // Размер отображаемой области = 8 КБ (одна страница памяти x2)
+#define MAX_WORKERS 256                     // Верхняя граница для -j N
+#define NAME_SIZE 64                        // Размер буфера для имён семафоров/mmap-файлов
+#define QUEUE_LEN (MAX_WORKERS * RING_SLOTS) // Кусков "в полёте" на весь пул (FIFO вывода)
+#define BATCH_TAG(k) (-1 - (k))              // Элемент очереди пакета: "вывести заголовок файла k"
+#define DAEMON_STOP_TIMEOUT 5                // Секунд ждать текущего клиента при остановке демона
+#define DAEMON_RETRY_NS 10000000L            // Клиент: пауза между попытками взять пул (10 мс)
+#define DAEMON_RETRIES 100                   // ...и сколько раз пробовать, пока демон не запустил пул
+#define OUT_IOV 64                           // Частей в одной пачке вывода (writev), IOV_MAX >= 1024
+
+static const char *precision_arg = NULL;     // --precision: передаётся дочерним как есть (NULL - по умолчанию)
+static int decimal = 0;                      // --decimal: дочерние суммируют в фиксированной точке
+static const char *agg_arg = NULL;           // --agg: список агрегатов, передаётся дочерним как есть
+static int columns = 0;                      // --columns: агрегаты колонками
+static const char *threads_arg = NULL;       // --threads: тоже как есть (NULL - один поток)
+static size_t shm_cap = SHM_CAP_DEFAULT;     // --buf: ёмкость in[]/out[] слота (у всех воркеров не меньше)
+static int sem_sync = SHM_SYNC_NAMED;        // --sem: где создавать семафоры ready/done
+static int stats_mode = 0;                   // --stats: построчная разбивка у дочерних + сводка в конце
+static char ipc_tag[24] = "";                // "-<PID>" - суффикс имён этого запуска (у демона пусто)
+static char child_path[PATH_MAX] = "./build/child"; // Рядом с parent (child_path_init), иначе как раньше
+static int inproc = 0;                       // --inproc: дочерние - потоки этого процесса
+static int follow = 0;                       // --follow: конец файла - ещё не конец, ждём дописанных строк
+static int follow_watch = -1;                // --follow: inotify с наблюдением за входным файлом
+static int follow_sig = -1;                  // --follow: signalfd для SIGINT/SIGTERM (остановка)
+static int pool_broken = 0;                  // Дочерний завершился, не ответив: пул не согласован, воркеров - только убить
+static int input_failed = 0;                 // Текущий файл с ошибкой во входе (SHM_FAILED): его результаты не выводятся
+static int input_errors = 0;                 // Файлов с такой ошибкой за запуск
+
+int child_main(int argc, char *argv[]);      // child.c, собранный с -DCHILD_EMBED (build/child_embed.o)
 
 /*
- * SharedData - структура данных в разделяемой памяти
- * 
- * КРИТИЧНО: Эта же структура должна быть в child.c!
- * Оба процесса работают с одной и той же областью памяти.
+ * Worker - один дочерний процесс со своим набором IPC-ресурсов
+ *
+ * В режиме -j N у каждого дочернего СВОЙ mmap-файл и СВОЯ пара семафоров,
+ * поэтому дочерние не мешают друг другу и работают параллельно.
+ * Имена: базовые (MMAP_FILE, SEM_READY, SEM_DONE) + ipc_tag запуска,
+ * у воркера i > 0 - ещё и суффикс ".i".
  */
 typedef struct {
-    size_t data_size;                                    // Количество актуальных байт в data[] (8 байт на x64)
-    char data[MMAP_SIZE - sizeof(size_t)];              // Буфер для данных (8192 - 8 = 8184 байт)
-} SharedData;
+    char mmap_file[NAME_SIZE];               // Путь к mmap-файлу этого воркера
+    char shm_name[NAME_SIZE];                // Имя POSIX shared memory (бэкенд posix, демон)
+    char sem_ready_name[NAME_SIZE];          // Имя семафора "данные готовы"
+    char sem_done_name[NAME_SIZE];           // Имя семафора "обработка завершена"
+    sem_t *sem_ready;                        // Дескриптор семафора ready
+    sem_t *sem_done;                         // Дескриптор семафора done
+    int mmap_fd;                             // Дескриптор mmap-файла (или memfd)
+    int backend;                             // SHM_BACKEND_MEMFD / SHM_BACKEND_FILE / SHM_BACKEND_POSIX
+    int attached;                            // 1 = клиент подключился к чужому воркеру (ничего не удаляем)
+    int ring;                                // 1 = транспорт --ring
+    int pshared;                             // 1 = семафоры в области (SHM_SYNC_PSHARED), не sem_open
+    void *map;                               // Отображённая область (RingShared + буферы)
+    size_t map_size;                         // Её размер (растёт в worker_grow)
+    SharedData *slots;                       // Слоты: 1 (семафоры) или RING_SLOTS (--ring)
+    unsigned nslots;                         // Количество слотов
+    RingShared *rs;                          // --ring: управляющие поля кольца (иначе NULL)
+    unsigned long submitted;                 // Сколько кусков отдано
+    unsigned long taken;                     // Сколько результатов забрано в пачку вывода (out_add)
+    unsigned long collected;                 // Сколько слотов выведено и освобождено (taken - collected - в пачке)
+    unsigned long stalls;                    // Сколько раз родитель ждал воркера (его кусок ещё не готов)
+    pid_t pid;                               // PID дочернего процесса
+    pthread_t thread;                        // --inproc: поток с child_main()
+    int thread_running;                      // 1 = поток запущен и ещё не дождались
+    char *args[24];                          // argv дочернего (поток читает его и после worker_start)
+    char fd_str[24];                         // Номер memfd строкой
+    char input_str[24];                      // Номер дескриптора входного файла строкой
+    int eof_sent;                            // 1 = дочерний уже получил SHM_EOF (и завершится)
+    int exited;                              // 1 = дочерний завершился (замечено в worker_alive)
+} Worker;
 
 /*
- * safe_write - Надёжная запись данных в файловый дескриптор
- * 
- * Зачем нужна: write() может записать МЕНЬШЕ чем count байт или быть прерван сигналом.
- * safe_write гарантирует запись ВСЕХ байт.
+ * read_full - Чтение до заполнения буфера или конца файла
+ *
+ * read() может вернуть МЕНЬШЕ байт, чем запрошено (pipe, сигнал), даже если
+ * файл ещё не закончился. Для потокового протокола важно отличать
+ * "кусок неполный" от "конец файла", поэтому дочитываем до count или EOF.
+ * Возвращает количество прочитанных байт (< count только при EOF) или -1.
  */
-static ssize_t safe_write(int fd, const void *buf, size_t count) {
-    const char *p = buf;                     // Указатель на текущую позицию в буфере (для сдвига)
-    size_t left = count;                     // Счётчик оставшихся байт для записи
-    
-    while (left > 0) {                       // Цикл пока есть незаписанные байты
-        ssize_t written = write(fd, p, left); // write() - системный вызов записи, возвращает количество записанных байт
-        
-        if (written < 0) {                   // Ошибка записи (возвращено -1)
-            if (errno == EINTR) continue;    // EINTR = прерван сигналом (например SIGCHLD), повторить попытку
-            return -1;                       // Другая ошибка - выход с ошибкой
+static ssize_t read_full(int fd, void *buf, size_t count) {
+    char *p = buf;                           // Текущая позиция в буфере
+    size_t got = 0;                          // Сколько уже прочитано
+
+    while (got < count) {
+        ssize_t n = read(fd, p + got, count - got);
+        if (n < 0) {
+            if (errno == EINTR) continue;    // Прерван сигналом - повторить
+            return -1;                       // Настоящая ошибка
         }
-        
-        p += written;                        // Сдвинуть указатель на количество записанных байт
-        left -= written;                     // Уменьшить счётчик оставшихся байт
+        if (n == 0) break;                   // EOF
+        got += (size_t)n;
     }
-    
-    return count;                            // Успех: все байты записаны
+
+    return (ssize_t)got;
+}
+
+/*
+ * format_uint - десятичная запись числа БЕЗ printf, возвращает длину (без '\0')
+ */
+static size_t format_uint(char *dst, unsigned long value) {
+    char tmp[24];                            // Цифры в обратном порядке
+    size_t tp = 0, len = 0;
+
+    do {
+        tmp[tp++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (tp > 0) dst[len++] = tmp[--tp];   // Сначала старшие разряды
+    dst[len] = '\0';
+    return len;
 }
 
-int main(void) {
-    char filename[BUF_SIZE] = {0};           // Буфер для имени файла, инициализирован нулями
+/*
+ * make_name - имя IPC-объекта для воркера: "base<tag>" для 0, "base<tag>.<index>" иначе
+ */
+static void make_name(char *dst, const char *base, int index) {
+    size_t len = strlen(base);               // Базовое имя с тегом гарантированно короче NAME_SIZE
+    memcpy(dst, base, len);
+    size_t tag_len = strlen(ipc_tag);
+    memcpy(dst + len, ipc_tag, tag_len + 1); // Вместе с '\0'
+    len += tag_len;
 
-    /* === ВВОД ИМЕНИ ФАЙЛА === */
-    safe_write(STDOUT_FILENO, "Enter filename: ", 16); // STDOUT_FILENO = 1 (стандартный вывод)
-    
-    ssize_t len = read(STDIN_FILENO, filename, BUF_SIZE - 1); // STDIN_FILENO = 0, читаем до 255 байт (резервируем место для '\0')
-    if (len <= 0) {                          // Ошибка чтения (EOF или ошибка)
-        safe_write(STDERR_FILENO, "Error reading filename\n", 23); // STDERR_FILENO = 2 (стандартный поток ошибок)
-        return 1;                            // Код возврата 1 = ошибка
+    if (index > 0) {
+        dst[len++] = '.';
+        format_uint(dst + len, (unsigned long)index);
     }
-    
-    char *newline = strchr(filename, '\n');  // strchr() ищет первое вхождение '\n', возвращает указатель или NULL
-    if (newline) *newline = '\0';            // Заменяем '\n' на '\0' (нуль-терминатор C-строки)
+}
+
+/*
+ * pid_alive - процесс существует и не зомби (зомби свои объекты уже не удалит)
+ *
+ * kill(pid, 0) успешен и для зомби, поэтому состояние - из /proc/PID/stat.
+ * EPERM - процесс чужого пользователя, но живой.
+ */
+static int pid_alive(pid_t pid) {
+    if (kill(pid, 0) < 0 && errno == ESRCH) return 0;
+
+    char path[40] = "/proc/", buf[256];
+    size_t len = 6 + format_uint(path + 6, (unsigned long)pid);
+    memcpy(path + len, "/stat", 6);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;                    // Нет /proc - верим kill()
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 1;
+    buf[n] = '\0';
+    const char *p = strrchr(buf, ')');       // "pid (comm) S ...": comm может содержать пробелы
+    return !(p && p[1] == ' ' && p[2] == 'Z');
+}
+
+/* DaemonLock - содержимое SHM_LOCK (замок пула демона, см. run_daemon) */
+typedef struct {
+    pid_t daemon;                            // PID демона; 0 - пул ещё запускается
+    pid_t owner;                             // Клиент, работающий с пулом; 0 - пул свободен и согласован
+    int stopping;                            // Демон останавливается: новых клиентов не пускать
+} DaemonLock;
+
+/*
+ * ipc_sweep - удалить объекты запусков, которые упали, не прибравшись
+ *
+ * В dir ищутся имена "<head><base>-<PID>[...]" (ipc_tag). Если процесса PID
+ * больше нет (или это зомби) - объект ничей, он только мешал бы (и занимал память /dev/shm).
+ * Наш собственный PID тоже означает чужой объект: его оставил умерший
+ * процесс, чей номер нам достался. Объекты демона - "<head><base>[.i]",
+ * без "-PID": по имени не узнать, жив ли он, поэтому их удаляем только
+ * по daemon_dead (это решает daemon_sweep по PID в SHM_LOCK).
+ */
+static void ipc_sweep(const char *dir, const char *head, const char *base, int daemon_dead) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    size_t head_len = strlen(head), base_len = strlen(base);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        const char *p = de->d_name;
+        if (strncmp(p, head, head_len) != 0 || strncmp(p + head_len, base, base_len) != 0) continue;
+        p += head_len + base_len;
+        if (*p == '\0' || *p == '.') {       // Имя демона
+            if (daemon_dead) unlinkat(dirfd(d), de->d_name, 0);
+            continue;
+        }
+        if (*p++ != IPC_TAG_SEP) continue;
+
+        char *end;
+        long pid = strtol(p, &end, 10);
+        if (end == p || (*end != '\0' && *end != '.') || pid <= 0) continue;
+        if (pid != (long)getpid() && pid_alive((pid_t)pid)) continue; // Владелец ещё работает
+        unlinkat(dirfd(d), de->d_name, 0);   // Ошибка не критична: удалит следующий запуск
+    }
+    closedir(d);
+}
+
+/*
+ * daemon_sweep - убрать объекты демона, если сам он умер, не прибравшись
+ *
+ * Демон, убитый SIGKILL (или OOM), оставляет SHM_LOCK, SHM_NAME[.i] и
+ * семафоры без ipc_tag - и следующий --daemon не запустился бы. Жив ли
+ * демон, видно по PID в DaemonLock. Замок, который кто-то держит, - живой
+ * демон (запускается или останавливается) или его клиент: не трогаем.
+ * Пока идёт уборка, старый замок держим мы: второй убирающий (новый
+ * демон) его не получит и не удалит то, что уже успел создать первый.
+ * Возвращает 1 - объекты убраны, 0 - убирать нечего или нельзя.
+ */
+static int daemon_sweep(void) {
+    int fd = shm_open(SHM_LOCK, O_RDWR, 0);
+    if (fd < 0) return 0;                    // Нет замка - нет и демона (замок удаляется последним)
+
+    int dead = 0;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        DaemonLock lk;                       // Пустой объект - демон между shm_open и flock: жив
+        dead = pread(fd, &lk, sizeof(lk), 0) == (ssize_t)sizeof(lk) &&
+               (lk.daemon == 0 || !pid_alive(lk.daemon)); // 0 и замок свободен - умер, не запустив пул
+        if (dead) {
+            ipc_sweep("/dev/shm", "", SHM_NAME + 1, 1);
+            ipc_sweep("/dev/shm", "sem.", SEM_READY + 1, 1);
+            ipc_sweep("/dev/shm", "sem.", SEM_DONE + 1, 1);
+            shm_unlink(SHM_LOCK);            // Последним, ещё под замком
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+    return dead;
+}
+
+/*
+ * ipc_instance - свои имена для этого запуска + уборка за упавшими
+ *
+ * Семафоры лежат в /dev/shm как "sem.<имя без '/'>", mmap-файлы - в /tmp.
+ */
+static void ipc_instance(void) {
+    ipc_tag[0] = IPC_TAG_SEP;
+    format_uint(ipc_tag + 1, (unsigned long)getpid());
+
+    ipc_sweep("/dev/shm", "sem.", SEM_READY + 1, 0);
+    ipc_sweep("/dev/shm", "sem.", SEM_DONE + 1, 0);
+    ipc_sweep("/tmp", "", MMAP_FILE + 5, 0); // "/tmp/os_lab3_mmap" -> "os_lab3_mmap"
+    daemon_sweep();                          // Имена демона - только если он умер
+}
+
+/*
+ * worker_destroy - освобождение ресурсов воркера
+ *
+ * kill_child = 1 - аварийный путь: дочерний ещё ждёт данных, завершаем его
+ * сигналом. При штатном завершении дочерний уже получил SHM_EOF и выходит сам.
+ * Подключённый клиентом воркер (attached) только закрывается: дочерний
+ * и IPC-объекты принадлежат демону.
+ */
+static void worker_destroy(Worker *w, int kill_child) {
+    if (w->thread_running) {
+        if (kill_child) pthread_detach(w->thread); // Поток не убить: он ждёт кусок, пока процесс не завершится
+        else pthread_join(w->thread, NULL);
+        w->thread_running = 0;
+    }
+    if (w->pid > 0) {
+        if (kill_child) kill(w->pid, SIGTERM); // kill() - отправляет сигнал процессу, SIGTERM = 15 (мягкое завершение)
+        waitpid(w->pid, NULL, 0);            // Ждём завершения дочернего (предотвращаем zombie процесс)
+        w->pid = 0;
+    }
+    if (w->map != MAP_FAILED && w->map != NULL) {
+        munmap(w->map, w->map_size);         // munmap() - отменяет отображение (НЕ удаляет файл!)
+        w->map = NULL;
+    }
+    if (w->mmap_fd >= 0) {
+        close(w->mmap_fd);                   // close() - закрывает дескриптор (memfd освобождается сам)
+        if (w->backend == SHM_BACKEND_FILE) unlink(w->mmap_file); // unlink() - удаляет файл (уменьшает link count → 0)
+        if (w->backend == SHM_BACKEND_POSIX && !w->attached) shm_unlink(w->shm_name); // shm_unlink() - удаляет объект из /dev/shm/
+        w->mmap_fd = -1;
+    }
+    if (w->pshared) {                        // Семафоры были полями области - ушли вместе с munmap
+        w->sem_ready = SEM_FAILED;
+        w->sem_done = SEM_FAILED;
+    }
+    if (w->sem_ready != SEM_FAILED) {
+        sem_close(w->sem_ready);             // sem_close() - закрывает дескриптор семафора (НЕ удаляет!)
+        if (!w->attached) sem_unlink(w->sem_ready_name); // sem_unlink() - удаляет семафор из /dev/shm/
+        w->sem_ready = SEM_FAILED;
+    }
+    if (w->sem_done != SEM_FAILED) {
+        sem_close(w->sem_done);
+        if (!w->attached) sem_unlink(w->sem_done_name);
+        w->sem_done = SEM_FAILED;
+    }
+}
+
+/* worker_wait - дождаться, пока дочерний (процесс или поток --inproc) завершится сам */
+static void worker_wait(Worker *w) {
+    if (w->thread_running) {
+        pthread_join(w->thread, NULL);
+        w->thread_running = 0;
+    }
+    if (w->pid > 0) {
+        waitpid(w->pid, NULL, 0);
+        w->pid = 0;
+    }
+}
+
+/*
+ * worker_alive - дочерний воркера ещё работает (shm_peer_alive на время ожидания)
+ *
+ * Свой процесс - waitpid(WNOHANG), завершившийся сразу "хороним"; дочерний
+ * демона у клиента - pid_alive() по child_pid из области (демон своих
+ * зомби не ждёт). Поток --inproc отдельно не завершается: _exit() в нём
+ * завершает весь процесс.
+ */
+static int worker_alive(void *arg) {
+    Worker *w = arg;
+
+    if (w->exited) return 0;
+    if (w->pid > 0 && waitpid(w->pid, NULL, WNOHANG) == 0) return 1;
+    if (w->pid > 0) {
+        w->pid = 0;
+        w->exited = 1;
+        return 0;
+    }
+    if (w->attached && w->rs->child_pid > 0 && !pid_alive(w->rs->child_pid)) w->exited = 1;
+    return !w->exited;
+}
+
+/* worker_bind_sems - SHM_SYNC_PSHARED: семафоры - поля области (заново после каждого mmap/mremap) */
+static void worker_bind_sems(Worker *w) {
+    w->sem_ready = &w->rs->sem_ready;
+    w->sem_done = &w->rs->sem_done;
+}
 
+/*
+ * worker_create_sems - создание пары именованных семафоров воркера
+ *
+ * Возвращает 0 при успехе, -1 при ошибке (уже созданное освобождено).
+ */
+static int worker_create_sems(Worker *w) {
     /* ====================================================================
      * СЕМАФОРЫ: Создание именованных POSIX семафоров
      * 
@@ -100,32 +433,135 @@ int main(void) {
      * ==================================================================== */
     
     /* sem_open() - создаёт или открывает именованный семафор */
-    sem_t *sem_ready = sem_open(              // sem_t* - дескриптор семафора (похож на FILE*)
-        SEM_READY,                           // const char *name - имя (должно начинаться с '/')
+    w->sem_ready = sem_open(                 // sem_t* - дескриптор семафора (похож на FILE*)
+        w->sem_ready_name,                   // const char *name - имя (должно начинаться с '/')
         O_CREAT | O_EXCL,                    // int oflag - O_CREAT создать, O_EXCL ошибка если существует
         0600,                                // mode_t mode - права доступа: 0600 = rw------- (только владелец)
         0                                    // unsigned int value - начальное значение счётчика (0 = заблокирован)
     );
     
-    if (sem_ready == SEM_FAILED) {           // SEM_FAILED = (sem_t*)-1 - специальное значение при ошибке
+    if (w->sem_ready == SEM_FAILED) {        // SEM_FAILED = (sem_t*)-1 - специальное значение при ошибке
         safe_write(STDERR_FILENO, "sem_open ready failed\n", 22);
-        return 1;
+        return -1;
     }
 
     /* Создание второго семафора для обратной связи (дочерний → родитель) */
-    sem_t *sem_done = sem_open(              // Все параметры аналогичны первому семафору
-        SEM_DONE,                            // Другое имя - это независимый семафор
+    w->sem_done = sem_open(                  // Все параметры аналогичны первому семафору
+        w->sem_done_name,                    // Другое имя - это независимый семафор
         O_CREAT | O_EXCL,                    // O_EXCL гарантирует что мы создаём новый (не открываем старый)
         0600,                                // Права доступа: только владелец
         0                                    // Начальное значение 0: sem_wait() сразу заблокирует
     );
     
-    if (sem_done == SEM_FAILED) {            // Проверка ошибки
+    if (w->sem_done == SEM_FAILED) {         // Проверка ошибки
         safe_write(STDERR_FILENO, "sem_open done failed\n", 21);
-        sem_close(sem_ready);                // Закрыть дескриптор первого семафора
-        sem_unlink(SEM_READY);               // Удалить семафор из /dev/shm/ (иначе останется "висеть")
-        return 1;
+        worker_destroy(w, 0);                // Закрыть и удалить первый семафор (иначе останется "висеть")
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * child_path_init - build/child рядом с исполняемым файлом parent
+ *
+ * "./build/child" работал только из корня репозитория. /proc/self/exe -
+ * настоящий путь parent, откуда бы его ни запустили; не вышло - остаётся
+ * прежний относительный путь.
+ */
+static void child_path_init(void) {
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len <= 0) return;
+    exe[len] = '\0';
+
+    char *slash = strrchr(exe, '/');
+    if (!slash || (size_t)(slash - exe) + sizeof("/child") > sizeof(child_path)) return;
+    memcpy(child_path, exe, (size_t)(slash - exe));
+    memcpy(child_path + (slash - exe), "/child", sizeof("/child")); // Вместе с '\0'
+}
+
+/*
+ * worker_args - argv дочернего: опции, область (--fd N или путь), имена семафоров
+ *
+ * fd - дескриптор memfd/shm (-1: бэкенд file, передаётся путь),
+ * input_fd - входной файл для --zero-copy (-1: нет).
+ */
+static void worker_args(Worker *w, int server, int fd, int input_fd) {
+    char **args = w->args;
+    int argn = 0;
+
+    args[argn++] = child_path;
+    if (w->ring) args[argn++] = "--ring";    // --ring: семафоры не нужны
+    if (server) args[argn++] = "--server";   // Демон: не завершаться после SHM_EOF
+    if (decimal) args[argn++] = "--decimal"; // Точная сумма (int64 в единицах 10^-precision)
+    if (agg_arg) {                           // Агрегаты строки (уже проверены в main)
+        args[argn++] = "--agg";
+        args[argn++] = (char *)agg_arg;
+    }
+    if (columns) args[argn++] = "--columns";
+    if (precision_arg) {                     // Формат "Sum: ..." (уже проверен в main)
+        args[argn++] = "--precision";
+        args[argn++] = (char *)precision_arg;
+    }
+    if (threads_arg) {                       // Потоков в дочернем (уже проверено в main)
+        args[argn++] = "--threads";
+        args[argn++] = (char *)threads_arg;
     }
+    if (input_fd >= 0) {                     // --zero-copy: дочерний отобразит файл сам
+        format_uint(w->input_str, (unsigned long)input_fd);
+        args[argn++] = "--input";
+        args[argn++] = w->input_str;
+    }
+
+    if (fd >= 0) {                           // memfd и posix: номер дескриптора
+        format_uint(w->fd_str, (unsigned long)fd);
+        args[argn++] = "--fd";
+        args[argn++] = w->fd_str;
+    } else {
+        args[argn++] = w->mmap_file;         // file: дочерний откроет файл по имени
+    }
+
+    if (!w->ring && !w->pshared) {
+        args[argn++] = w->sem_ready_name;
+        args[argn++] = w->sem_done_name;
+    }
+    args[argn] = NULL;
+}
+
+/* worker_thread - --inproc: цикл дочернего в потоке родителя */
+static void *worker_thread(void *arg) {
+    Worker *w = arg;
+    int argc = 0;
+
+    while (w->args[argc]) argc++;
+    child_main(argc, w->args);
+    return NULL;
+}
+
+/*
+ * worker_start - создание семафоров, mmap-файла и дочернего процесса
+ *
+ * input_fd >= 0 (--zero-copy) - дескриптор входного файла, который
+ * дочерний унаследует и отобразит сам.
+ * Возвращает 0 при успехе, -1 при ошибке (уже созданное освобождено).
+ */
+static int worker_start(Worker *w, int index, int ring, int backend, int server, int input_fd) {
+    memset(w, 0, sizeof(*w));
+    w->sem_ready = SEM_FAILED;
+    w->sem_done = SEM_FAILED;
+    w->mmap_fd = -1;
+    w->backend = backend;
+    w->ring = ring;
+    w->pshared = !ring && sem_sync == SHM_SYNC_PSHARED;
+    w->nslots = ring ? RING_SLOTS : SHM_BUFFERS;
+    w->map_size = SHM_REGION_SIZE(w->nslots, shm_cap);
+    make_name(w->mmap_file, MMAP_FILE, index);
+    make_name(w->shm_name, SHM_NAME, index);
+    make_name(w->sem_ready_name, SEM_READY, index);
+    make_name(w->sem_done_name, SEM_DONE, index);
+
+    if (!ring && !w->pshared && worker_create_sems(w) < 0) return -1; // --ring обходится без семафоров
 
     /* ====================================================================
      * MEMORY-MAPPED FILES: Создание файла для mmap
@@ -140,21 +576,37 @@ int main(void) {
      * - Нет копирования данных (user space ↔ kernel space)
      * - Эффективное использование памяти (demand paging)
      * - Упрощение кода (указатели вместо системных вызовов)
+     *
+     * Бэкенд memfd (по умолчанию): memfd_create() создаёт анонимный
+     * файл в RAM без имени в файловой системе. Его нельзя открыть по
+     * пути, поэтому дочерний получает сам дескриптор - он переживает
+     * execv(), если снять с него FD_CLOEXEC. Ничего не остаётся в /tmp,
+     * даже если процессы упадут.
+     *
+     * Бэкенд posix (демон): shm_open() - та же память в RAM, но с именем
+     * в /dev/shm/, чтобы клиенты могли найти область демона. Дочернему
+     * fd по-прежнему передаётся через execv (shm_open ставит FD_CLOEXEC).
      * ==================================================================== */
     
-    int mmap_fd = open(                      // open() - системный вызов открытия/создания файла
-        MMAP_FILE,                           // const char *pathname - путь к файлу
-        O_RDWR | O_CREAT,                    // int flags - O_RDWR чтение+запись (нужно для mmap), O_CREAT создать если нет
-        S_IRUSR | S_IWUSR                    // mode_t mode - S_IRUSR user read (0400), S_IWUSR user write (0200), итого 0600
-    );
+    if (backend == SHM_BACKEND_MEMFD) {
+        /* MFD_CLOEXEC: дочерние ДРУГИХ воркеров не должны унаследовать этот fd */
+        w->mmap_fd = memfd_create(MEMFD_NAME, MFD_CLOEXEC);
+    } else if (backend == SHM_BACKEND_POSIX) {
+        /* O_EXCL: второй демон не должен перехватить объекты работающего */
+        w->mmap_fd = shm_open(w->shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    } else {
+        w->mmap_fd = open(                   // open() - системный вызов открытия/создания файла
+            w->mmap_file,                    // const char *pathname - путь к файлу
+            O_RDWR | O_CREAT | O_CLOEXEC,    // int flags - O_RDWR чтение+запись (нужно для mmap), O_CREAT создать если нет
+                                             // (O_CLOEXEC: дочерний откроет файл сам, по имени)
+            S_IRUSR | S_IWUSR                // mode_t mode - S_IRUSR user read (0400), S_IWUSR user write (0200), итого 0600
+        );
+    }
     
-    if (mmap_fd < 0) {                       // Ошибка: возвращено -1
+    if (w->mmap_fd < 0) {                    // Ошибка: возвращено -1
         safe_write(STDERR_FILENO, "Cannot create mmap file\n", 24);
-        sem_close(sem_ready);                // Очистка всех уже созданных ресурсов
-        sem_close(sem_done);
-        sem_unlink(SEM_READY);
-        sem_unlink(SEM_DONE);
-        return 1;
+        worker_destroy(w, 0);                // Очистка всех уже созданных ресурсов
+        return -1;
     }
 
     /* ====================================================================
@@ -163,22 +615,17 @@ int main(void) {
      * КРИТИЧНО для mmap!
      * - Новый файл имеет размер 0 байт
      * - mmap() НЕ МОЖЕТ отобразить файл размером 0 байт
-     * - ftruncate() расширяет файл до MMAP_SIZE байт (заполняет '\0')
+     * - ftruncate() расширяет файл до map_size байт (заполняет '\0')
      * 
      * Как работает:
      * - Если новый размер > текущего → расширяет (добавляет нули)
      * - Если новый размер < текущего → обрезает (теряет данные)
      * - Изменяет метаданные файла (inode->i_size)
      * ==================================================================== */
-    if (ftruncate(mmap_fd, MMAP_SIZE) == -1) { // ftruncate(int fd, off_t length) возвращает 0 при успехе, -1 при ошибке
+    if (ftruncate(w->mmap_fd, (off_t)w->map_size) == -1) { // ftruncate(int fd, off_t length) возвращает 0 при успехе, -1 при ошибке
         safe_write(STDERR_FILENO, "ftruncate error\n", 16);
-        close(mmap_fd);                      // close() - закрывает файловый дескриптор (освобождает номер в таблице дескрипторов)
-        unlink(MMAP_FILE);                   // unlink() - удаляет файл из файловой системы (уменьшает link count)
-        sem_close(sem_ready);
-        sem_close(sem_done);
-        sem_unlink(SEM_READY);
-        sem_unlink(SEM_DONE);
-        return 1;
+        worker_destroy(w, 0);
+        return -1;
     }
 
     /* ====================================================================
@@ -197,204 +644,1717 @@ int main(void) {
      * - MAP_SHARED: изменения попадают в файл, видны другим процессам (IPC)
      * - MAP_PRIVATE: Copy-on-Write, изменения в приватной копии (НЕ IPC)
      * ==================================================================== */
-    SharedData *shared = mmap(               // void* mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+    w->map = mmap(                           // void* mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
         NULL,                                // void *addr - NULL = ОС сама выберет виртуальный адрес (рекомендуется)
-        MMAP_SIZE,                           // size_t length - размер отображения в байтах (8192)
+        w->map_size,                         // size_t length - размер отображения в байтах (SHM_REGION_SIZE(nslots, cap))
         PROT_READ | PROT_WRITE,              // int prot - PROT_READ разрешить чтение, PROT_WRITE разрешить запись
-        MAP_SHARED,                          // int flags - MAP_SHARED КРИТИЧНО! Изменения видны другим процессам
-        mmap_fd,                             // int fd - файловый дескриптор открытого файла
+        MAP_SHARED | SHM_POPULATE(w->map_size), // int flags - MAP_SHARED КРИТИЧНО! Изменения видны другим процессам; большую область - сразу в память
+        w->mmap_fd,                          // int fd - файловый дескриптор открытого файла
         0                                    // off_t offset - смещение в файле (0 = начало файла, должно быть кратно page size)
     );
     
-    if (shared == MAP_FAILED) {              // MAP_FAILED = (void*)-1 - специальное значение при ошибке
+    if (w->map == MAP_FAILED) {              // MAP_FAILED = (void*)-1 - специальное значение при ошибке
         safe_write(STDERR_FILENO, "mmap error\n", 11);
-        close(mmap_fd);
-        unlink(MMAP_FILE);
-        sem_close(sem_ready);
-        sem_close(sem_done);
-        sem_unlink(SEM_READY);
-        sem_unlink(SEM_DONE);
-        return 1;
+        worker_destroy(w, 0);
+        return -1;
     }
 
-    memset(shared, 0, MMAP_SIZE);            // memset() - заполняет область памяти указанным байтом (0 = '\0')
+    shm_advise(w->map, w->map_size, 0);      // Большая область: huge pages
+    memset(w->map, 0, w->map_size);          // memset() - заполняет область памяти указанным байтом (0 = '\0'), все слоты SLOT_FREE
+
+    w->rs = w->map;                          // Управляющие поля + слоты (см. RingShared в common.h)
+    w->slots = w->rs->slot;
+    shm_init(w->rs, w->nslots, shm_cap);     // Раскладка - в самой области: дочерний её проверит
+    if (w->pshared) {
+        /* ================================================================
+         * Неименованные семафоры (--sem pshared)
+         *
+         * sem_init(sem, pshared = 1, 0) - тот же sem_t, но в памяти,
+         * которую видят оба процесса (MAP_SHARED). Ни sem_open/sem_unlink,
+         * ни файлов sem.* в /dev/shm, ни отдельного отображения на каждый
+         * семафор: всё живёт и умирает вместе с областью. Дочерний узнаёт
+         * об этом из заголовка (sync) - имена в argv не передаются.
+         * ================================================================ */
+        if (sem_init(&w->rs->sem_ready, 1, 0) < 0 || sem_init(&w->rs->sem_done, 1, 0) < 0) {
+            safe_write(STDERR_FILENO, "sem_init failed\n", 16);
+            worker_destroy(w, 0);
+            return -1;
+        }
+        w->rs->sync = SHM_SYNC_PSHARED;
+        worker_bind_sems(w);
+    }
+    stat_init(&w->rs->stats);                // Отсчёт времени для --stats и lab3stat
+    w->rs->stats.detail = (unsigned)stats_mode;
 
     /* ====================================================================
-     * fork() - создание дочернего процесса
-     * 
-     * Что происходит при fork():
-     * 1. Kernel создаёт копию структуры task_struct (дескриптор процесса)
-     * 2. Копирует таблицу страниц (Page Table) - НЕ саму память!
-     * 3. Обычные страницы помечаются Copy-on-Write (при записи → копируются)
-     * 4. mmap MAP_SHARED страницы НЕ копируются (остаются shared)
-     * 5. Оба процесса продолжают выполнение с одной инструкции
-     * 
-     * Возвращаемое значение fork():
-     * - В родителе: PID дочернего процесса (> 0)
-     * - В дочернем: 0
-     * - При ошибке: -1
+     * Запуск дочернего: posix_spawn() вместо fork() + execv()
+     *
+     * fork() копирует таблицы страниц родителя (и помечает его память
+     * copy-on-write) - только затем, чтобы execv() тут же всё выбросил.
+     * posix_spawn() в glibc делает clone(CLONE_VM | CLONE_VFORK): потомок
+     * до exec работает в памяти родителя, копировать нечего, и стоимость
+     * запуска не растёт с размером родителя (с -j 64 - заметно).
+     *
+     * Дескрипторы: memfd/shm и входной файл открыты с FD_CLOEXEC, чтобы их
+     * не унаследовали дочерние ДРУГИХ воркеров. Этому потомку они нужны:
+     * adddup2(fd, fd) в file actions снимает с них FD_CLOEXEC только в
+     * потомке, у родителя флаг остаётся.
+     *
+     * --inproc: тот же argv получает child_main() в потоке. Дочерний сам
+     * закрывает переданные дескрипторы, поэтому ему достаются копии.
      * ==================================================================== */
-    pid_t child_pid = fork();                // pid_t - тип для ID процесса (обычно int)
-    
-    if (child_pid < 0) {                     // Ошибка fork() (не хватило памяти, превышен лимит процессов и т.д.)
-        safe_write(STDERR_FILENO, "fork error\n", 11);
-        munmap(shared, MMAP_SIZE);           // munmap() - отменяет отображение файла в память
-        close(mmap_fd);
-        unlink(MMAP_FILE);
-        sem_close(sem_ready);
-        sem_close(sem_done);
-        sem_unlink(SEM_READY);
-        sem_unlink(SEM_DONE);
-        return 1;
+    int fd = w->backend != SHM_BACKEND_FILE ? w->mmap_fd : -1; // memfd и posix: передаём сам дескриптор
+    if (inproc) {
+        if (fd >= 0) fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (input_fd >= 0) input_fd = fcntl(input_fd, F_DUPFD_CLOEXEC, 0);
     }
-    
-    if (child_pid == 0) {
-        /* === ДОЧЕРНИЙ ПРОЦЕСС === */
-        
-        close(mmap_fd);                      // Закрываем дескриптор (не нужен, отображение уже активно)
-        
-        char *args[] = {"./build/child", MMAP_FILE, NULL}; // Массив аргументов: argv[0], argv[1], NULL-терминатор
-        execv("./build/child", args);        // execv() - заменяет текущий процесс новой программой (НЕ создаёт процесс!)
-        
-        /* Если execv() вернул управление - ОШИБКА! */
-        safe_write(STDERR_FILENO, "exec error\n", 11);
-        _exit(1);                            // _exit() - немедленный выход БЕЗ вызова atexit() обработчиков (быстрее exit())
-    }
-    else {
-        /* === РОДИТЕЛЬСКИЙ ПРОЦЕСС === */
-
-        int file_fd = open(filename, O_RDONLY); // O_RDONLY - только для чтения (read-only)
-        if (file_fd < 0) {
-            safe_write(STDERR_FILENO, "Cannot open file\n", 17);
-            kill(child_pid, SIGTERM);        // kill() - отправляет сигнал процессу, SIGTERM = 15 (мягкое завершение)
-            wait(NULL);                      // wait() - ждёт завершения любого дочернего, NULL = не интересует статус
-            munmap(shared, MMAP_SIZE);
-            close(mmap_fd);
-            unlink(MMAP_FILE);
-            sem_close(sem_ready);
-            sem_close(sem_done);
-            sem_unlink(SEM_READY);
-            sem_unlink(SEM_DONE);
-            return 1;
+    worker_args(w, server, fd, input_fd);
+
+    if (inproc) {
+        if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+            safe_write(STDERR_FILENO, "pthread_create error\n", 21);
+            worker_destroy(w, 0);
+            return -1;
         }
+        w->thread_running = 1;
+        return 0;
+    }
 
-        ssize_t bytes_read = read(file_fd, shared->data, sizeof(shared->data) - 1); // read() - читает из дескриптора в буфер
-        close(file_fd);                      // Файл прочитан, дескриптор больше не нужен
-        
-        if (bytes_read < 0) {                // Ошибка чтения
-            safe_write(STDERR_FILENO, "Error reading file\n", 19);
-            kill(child_pid, SIGTERM);
-            wait(NULL);
-            munmap(shared, MMAP_SIZE);
-            close(mmap_fd);
-            unlink(MMAP_FILE);
-            sem_close(sem_ready);
-            sem_close(sem_done);
-            sem_unlink(SEM_READY);
-            sem_unlink(SEM_DONE);
-            return 1;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    if (fd >= 0) posix_spawn_file_actions_adddup2(&fa, fd, fd); // Снять FD_CLOEXEC - дескриптор переживёт exec
+    if (input_fd >= 0) posix_spawn_file_actions_adddup2(&fa, input_fd, input_fd);
+    posix_spawnattr_t attr;                  // Пустая маска сигналов: --follow блокирует SIGINT/SIGTERM
+    sigset_t none;                           // до запуска пула, а дочерним они нужны (kill() в worker_destroy)
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    pid_t child_pid;
+    int err = posix_spawn(&child_pid, child_path, &fa, &attr, w->args, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {                          // Нет файла child, не хватило памяти, превышен лимит процессов...
+        safe_write(STDERR_FILENO, "Cannot start child: ", 20);
+        safe_write(STDERR_FILENO, child_path, strlen(child_path));
+        safe_write(STDERR_FILENO, "\n", 1);
+        worker_destroy(w, 0);
+        return -1;
+    }
+
+    w->pid = child_pid;
+    w->rs->child_pid = child_pid;            // Для клиентов демона (worker_alive)
+    return 0;
+}
+
+/*
+ * worker_attach - клиент подключается к воркеру index работающего демона
+ *
+ * Ничего не создаёт: открывает shm-объект и семафоры по именам.
+ * Транспорт и ёмкости читаются из заголовка области (RING_SLOTS слотов = --ring).
+ * Возвращает 0 при успехе, -1 если воркера с таким номером нет.
+ */
+static int worker_attach(Worker *w, int index) {
+    struct stat st;                          // fstat(): размер shm-объекта
+
+    memset(w, 0, sizeof(*w));
+    w->sem_ready = SEM_FAILED;
+    w->sem_done = SEM_FAILED;
+    w->backend = SHM_BACKEND_POSIX;
+    w->attached = 1;
+    make_name(w->shm_name, SHM_NAME, index);
+    make_name(w->sem_ready_name, SEM_READY, index);
+    make_name(w->sem_done_name, SEM_DONE, index);
+
+    w->mmap_fd = shm_open(w->shm_name, O_RDWR, 0); // Без O_CREAT: только существующий объект
+    if (w->mmap_fd < 0) return -1;
+
+    if (fstat(w->mmap_fd, &st) < 0) {
+        worker_destroy(w, 0);
+        return -1;
+    }
+    w->map_size = (size_t)st.st_size;        // Область могла вырасти у прошлого клиента
+    w->map = mmap(NULL, w->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, w->mmap_fd, 0);
+    if (w->map == MAP_FAILED || shm_check(w->map, w->map_size) < 0) {
+        worker_destroy(w, 0);
+        return -1;
+    }
+    w->rs = w->map;
+    w->nslots = w->rs->nslots;
+    w->ring = (w->nslots == RING_SLOTS);
+    w->pshared = !w->ring && w->rs->sync == SHM_SYNC_PSHARED; // Как запущен демон
+
+    if (w->pshared) {
+        worker_bind_sems(w);
+    } else if (!w->ring) {
+        w->sem_ready = sem_open(w->sem_ready_name, 0); // 0 = только открыть
+        w->sem_done = sem_open(w->sem_done_name, 0);
+        if (w->sem_ready == SEM_FAILED || w->sem_done == SEM_FAILED) {
+            worker_destroy(w, 0);
+            return -1;
         }
+    }
 
-        shared->data[bytes_read] = '\0';     // Добавляем нуль-терминатор (превращаем в C-строку)
-        shared->data_size = (size_t)bytes_read; // Сохраняем размер данных (size_t - беззнаковый тип)
+    w->slots = w->rs->slot;
+    w->submitted = w->rs->next_seq;          // Продолжаем кольцо с того слота, где остановился прошлый клиент
+    w->collected = w->taken = w->submitted;
 
-        /* ================================================================
-         * msync() - синхронизация memory-mapped региона с файлом
-         * 
-         * КРИТИЧНО для корректного IPC через mmap!
-         * 
-         * Зачем нужен:
-         * Без msync() изменения могут "застрять" на разных уровнях:
-         * 1. CPU Store Buffer - буфер записи процессора
-         * 2. CPU Cache (L1, L2, L3) - кэш процессора
-         * 3. TLB (Translation Lookaside Buffer) - кэш адресных трансляций
-         * 4. Page Cache (kernel) - кэш страниц в ядре
-         * 
-         * Другой процесс может читать СТАРЫЕ данные из своего кэша!
-         * 
-         * Что делает msync(MS_SYNC):
-         * 1. Выполняет memory barrier (инструкции mfence/sfence на x86)
-         * 2. Сбрасывает CPU cache (инструкция clflush на x86)
-         * 3. Записывает dirty pages из Page Cache на диск
-         * 4. Обновляет metadata файла (mtime, atime)
-         * 5. БЛОКИРУЕТ процесс до завершения физической записи
-         * 
-         * Флаги msync():
-         * - MS_SYNC: блокирующий, гарантия записи на диск
-         * - MS_ASYNC: асинхронный, только запланировать запись
-         * - MS_INVALIDATE: обновить все копии в памяти
-         * ================================================================ */
-        msync(shared, MMAP_SIZE, MS_SYNC);   // int msync(void *addr, size_t length, int flags)
+    return 0;
+}
 
-        /* ================================================================
-         * sem_post() - увеличение счётчика семафора (V операция)
-         * 
-         * Атомарный алгоритм sem_post():
-         * 1. Атомарно увеличить счётчик на 1 (используя lock prefix на x86)
-         * 2. Если счётчик был ≤ 0 (есть ожидающие процессы):
-         *    - Убрать один процесс из очереди ожидания
-         *    - Разбудить его (перевести в состояние RUNNABLE)
-         *    - Scheduler выберет когда запустить
-         * 
-         * В нашем случае:
-         * - Счётчик был 0
-         * - Становится 1
-         * - Дочерний процесс в sem_wait(ready) разблокируется
-         * 
-         * Гарантии атомарности:
-         * - x86: LOCK ADD инструкция (блокировка шины памяти)
-         * - ARM: LDREX/STREX (Load/Store Exclusive)
-         * - Работает корректно на SMP (multi-CPU) системах
-         * ================================================================ */
-        sem_post(sem_ready);                 // int sem_post(sem_t *sem)
+/*
+ * worker_grow - увеличить in[]/out[] воркера до cap байт
+ *
+ * Только когда все слоты воркера FREE: буферы меняют место в области.
+ * ftruncate растит сам объект (memfd/файл/shm), mremap - наше отображение
+ * (MREMAP_MAYMOVE: адрес может смениться). Дочерний узнает о росте по
+ * region_size, получив следующий кусок, и сделает mremap у себя.
+ * Возвращает 0 или -1 (область осталась прежней).
+ */
+static int worker_grow(Worker *w, size_t cap) {
+    size_t size = SHM_REGION_SIZE(w->nslots, cap);
 
-        /* ================================================================
-         * sem_wait() - уменьшение счётчика семафора (P операция)
-         * 
-         * Атомарный алгоритм sem_wait():
-         * 1. Атомарно уменьшить счётчик на 1
-         * 2. Если результат < 0:
-         *    - Добавить текущий процесс в очередь ожидания
-         *    - Перевести процесс в состояние SLEEPING (не потребляет CPU)
-         *    - Передать управление scheduler (context switch)
-         * 3. Процесс "спит" до вызова sem_post() другим процессом
-         * 
-         * В нашем случае:
-         * - Счётчик sem_done был 0
-         * - 0 - 1 = -1
-         * - -1 < 0 → родитель засыпает
-         * - Проснётся когда дочерний вызовет sem_post(sem_done)
-         * 
-         * Отличие от busy-wait:
-         * - while(flag) {} - CPU постоянно проверяет (100% загрузка)
-         * - sem_wait() - процесс спит (0% CPU)
-         * 
-         * Отличие от pause():
-         * - pause() - ждёт ЛЮБОГО сигнала (небезопасно)
-         * - sem_wait() - ждёт конкретного события (безопасно)
-         * ================================================================ */
-        sem_wait(sem_done);                  // int sem_wait(sem_t *sem)
+    if (ftruncate(w->mmap_fd, (off_t)size) < 0) return -1; // Новые байты - нули
+    void *m = mremap(w->map, w->map_size, size, MREMAP_MAYMOVE);
+    if (m == MAP_FAILED) return -1;          // Объект уже больше - не страшно, дочерний не узнает
+    shm_advise(m, size, 1);
+
+    w->map = m;
+    w->map_size = size;
+    w->rs = m;
+    w->slots = w->rs->slot;
+    if (w->pshared) worker_bind_sems(w);     // Семафоры переехали вместе с областью
+    w->rs->in_cap = w->rs->out_cap = cap;    // Опубликуется вместе со следующим SLOT_READY (release)
+    w->rs->region_size = size;
+    return 0;
+}
 
-        /* msync() для чтения свежих данных от дочернего процесса */
-        msync(shared, MMAP_SIZE, MS_SYNC);   // Обновляем наш кэш из Page Cache (kernel)
+/* worker_can_submit - есть ли у воркера свободный слот под новый кусок */
+static int worker_can_submit(const Worker *w) {
+    return w->submitted - w->collected < w->nslots;
+}
 
-        safe_write(STDOUT_FILENO, "Result:\n", 8);
-        if (shared->data_size > 0) {
-            safe_write(STDOUT_FILENO, shared->data, shared->data_size);
+/* worker_slot - слот, в который родитель кладёт следующий кусок */
+static SharedData *worker_slot(Worker *w) {
+    return &w->slots[w->submitted % w->nslots];
+}
+
+/*
+ * worker_dispatch - отдать воркеру кусок, уже лежащий в worker_slot(w)->in
+ */
+static void worker_dispatch(Worker *w, size_t in_size, unsigned flags) {
+    SharedData *shared = worker_slot(w);
+
+    shared->in_size = in_size;               // Сохраняем размер куска (size_t - беззнаковый тип)
+    shared->out_size = 0;
+    shared->flags = flags;                   // SHM_EOF для последнего куска
+    if (flags & SHM_EOF) w->eof_sent = 1;
+    w->submitted++;
+    w->rs->next_seq = w->submitted;          // Демон: позиция кольца переживёт и SIGKILL клиента (daemon_reset)
+    w->rs->stats.p_chunks++;
+    shm_msync_ticks = &w->rs->stats.p_msync; // msync этого обмена - в счётчик этого воркера
+
+    if (w->ring) {
+        /* release: in[] и поля выше видны дочернему раньше, чем SLOT_READY */
+        ring_set(&shared->state, SLOT_READY, &w->rs->child_sleeping);
+        return;
+    }
+
+    /* Флаг владения: буфер переходит дочернему (release - in[] виден раньше state) */
+    atomic_store_explicit(&shared->state, SLOT_READY, memory_order_release);
+
+    /* ================================================================
+     * msync() - синхронизация memory-mapped региона с файлом
+     * 
+     * КРИТИЧНО для корректного IPC через mmap!
+     * 
+     * Зачем нужен:
+     * Без msync() изменения могут "застрять" на разных уровнях:
+     * 1. CPU Store Buffer - буфер записи процессора
+     * 2. CPU Cache (L1, L2, L3) - кэш процессора
+     * 3. TLB (Translation Lookaside Buffer) - кэш адресных трансляций
+     * 4. Page Cache (kernel) - кэш страниц в ядре
+     * 
+     * Другой процесс может читать СТАРЫЕ данные из своего кэша!
+     * 
+     * Что делает msync(MS_SYNC):
+     * 1. Выполняет memory barrier (инструкции mfence/sfence на x86)
+     * 2. Сбрасывает CPU cache (инструкция clflush на x86)
+     * 3. Записывает dirty pages из Page Cache на диск
+     * 4. Обновляет metadata файла (mtime, atime)
+     * 5. БЛОКИРУЕТ процесс до завершения физической записи
+     * 
+     * Флаги msync():
+     * - MS_SYNC: блокирующий, гарантия записи на диск
+     * - MS_ASYNC: асинхронный, только запланировать запись
+     * - MS_INVALIDATE: обновить все копии в памяти
+     * ================================================================ */
+    /* Бэкенд memfd: вместо msync достаточно release-барьера (см. shm_release в common.h) */
+    shm_release(w->map, w->map_size, w->backend == SHM_BACKEND_FILE); // int msync(void *addr, size_t length, int flags)
+
+    /* ================================================================
+     * sem_post() - увеличение счётчика семафора (V операция)
+     * 
+     * Атомарный алгоритм sem_post():
+     * 1. Атомарно увеличить счётчик на 1 (используя lock prefix на x86)
+     * 2. Если счётчик был ≤ 0 (есть ожидающие процессы):
+     *    - Убрать один процесс из очереди ожидания
+     *    - Разбудить его (перевести в состояние RUNNABLE)
+     *    - Scheduler выберет когда запустить
+     * 
+     * В нашем случае:
+     * - Счётчик был 0
+     * - Становится 1
+     * - Дочерний процесс в sem_wait(ready) разблокируется
+     * 
+     * Гарантии атомарности:
+     * - x86: LOCK ADD инструкция (блокировка шины памяти)
+     * - ARM: LDREX/STREX (Load/Store Exclusive)
+     * - Работает корректно на SMP (multi-CPU) системах
+     * ================================================================ */
+    sem_post(w->sem_ready);                  // int sem_post(sem_t *sem) - "звонок", какой буфер готов - говорит state
+}
+
+/* ============================================================================
+ * ВЫВОД РЕЗУЛЬТАТОВ ПАЧКАМИ
+ *
+ * Раньше каждый кусок выводился своим write(): при -j N и мелких кусках
+ * это системный вызов на кусок. Теперь готовые результаты собираются в
+ * пачку - массив struct iovec, указывающих ПРЯМО в out[] слотов (без
+ * копирования), вперемешку с заголовками файлов пакета, - и выводятся
+ * одним writev(). Слот освобождается (FREE) только после вывода: до тех
+ * пор его out[] - часть пачки, и дочерний не должен туда писать.
+ * Отсюда два счётчика воркера: taken (результат в пачке) и collected
+ * (слот выведен и свободен); новые куски отдаются по collected.
+ *
+ * vmsplice()/splice() здесь не подходят: они передают в pipe ссылки на
+ * страницы out[], а слот сразу же переиспользуется - читатель pipe увидел
+ * бы уже следующие результаты. Копия в ядро при writev() дешевле, чем
+ * ждать, пока читатель дочитает.
+ * ============================================================================ */
+static struct {
+    struct iovec iov[OUT_IOV];               // Части по порядку вывода
+    Worker *owner[OUT_IOV];                  // Чей слот освободить после вывода (NULL - не слот)
+    int n;
+    PhaseStats *st;                          // Куда записать время вывода (p_write)
+} out_batch;
+
+/* writev_full - writev() до конца (частичная запись, EINTR) */
+static void writev_full(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;                          // stdout закрыт - выводить некуда, как и с safe_write()
+        }
+        while (n > 0 && (size_t)written >= iov->iov_len) { // Целиком записанные части
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {                         // Часть записана наполовину
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
         }
+    }
+}
 
-        wait(NULL);                          // Ждём завершения дочернего (предотвращаем zombie процесс)
+/* out_flush - вывести пачку и освободить её слоты */
+static void out_flush(void) {
+    if (out_batch.n == 0) return;
+    unsigned long t0 = stat_ticks();
+    writev_full(STDOUT_FILENO, out_batch.iov, out_batch.n);
+    if (out_batch.st) out_batch.st->p_write += stat_ticks() - t0;
 
-        /* === ОЧИСТКА РЕСУРСОВ === */
-        munmap(shared, MMAP_SIZE);           // munmap() - отменяет отображение (НЕ удаляет файл!)
-        close(mmap_fd);                      // close() - закрывает дескриптор
-        unlink(MMAP_FILE);                   // unlink() - удаляет файл (уменьшает link count → 0)
-        
-        sem_close(sem_ready);                // sem_close() - закрывает дескриптор семафора (НЕ удаляет!)
-        sem_close(sem_done);
-        sem_unlink(SEM_READY);               // sem_unlink() - удаляет семафор из /dev/shm/
-        sem_unlink(SEM_DONE);
+    for (int i = 0; i < out_batch.n; i++) {  // Слоты одного воркера - в порядке taken
+        Worker *w = out_batch.owner[i];
+        if (!w) continue;
+        SharedData *shared = &w->slots[w->collected % w->nslots];
+        atomic_store_explicit(&shared->state, SLOT_FREE, memory_order_relaxed); // Слот снова наш
+        w->collected++;
     }
-    
-    return 0;                                // Успешное завершение
-}
\ No newline at end of file
+    out_batch.n = 0;
+    out_batch.st = NULL;
+}
+
+/* out_add - дописать часть в пачку (owner != NULL: слот, освободить после вывода) */
+static void out_add(const void *data, size_t len, Worker *owner) {
+    if (out_batch.n == OUT_IOV) out_flush();
+    out_batch.iov[out_batch.n].iov_base = (void *)data;
+    out_batch.iov[out_batch.n].iov_len = len;
+    out_batch.owner[out_batch.n] = owner;
+    out_batch.n++;
+    if (owner && !out_batch.st) out_batch.st = &owner->rs->stats;
+}
+
+/* worker_ready - следующий результат воркера уже готов (забрать без ожидания) */
+static int worker_ready(Worker *w) {
+    if (w->taken == w->submitted || w->backend == SHM_BACKEND_FILE) return 0; // file: видимость - через msync в ожидании
+    SharedData *shared = &w->slots[w->taken % w->nslots];
+    return atomic_load_explicit(&shared->state, memory_order_acquire) == SLOT_DONE;
+}
+
+/*
+ * slot_wait - дождаться, пока дочерний вернёт слот: SLOT_DONE или SLOT_MORE
+ *
+ * Ждём не вслепую: раз в SHM_ALIVE_MS - жив ли дочерний (worker_alive).
+ * Дочерний завершился, так и не ответив (_exit на ошибке разбора, ERANGE,
+ * "Bad input range"), - SLOT_DEAD: без этой проверки родитель (а с ним
+ * весь пул или демон) ждал бы вечно.
+ */
+static unsigned slot_wait(Worker *w, SharedData *shared) {
+    shm_peer_alive = worker_alive;
+    shm_peer = w;
+
+    if (w->ring) {
+        /* acquire: после DONE/MORE видим out[] дочернего */
+        return ring_wait(&shared->state, SLOT_DONE, SLOT_MORE, &w->rs->parent_sleeping);
+    }
+    /* ================================================================
+     * sem_wait() - уменьшение счётчика семафора (P операция)
+     * 
+     * Атомарный алгоритм sem_wait():
+     * 1. Атомарно уменьшить счётчик на 1
+     * 2. Если результат < 0:
+     *    - Добавить текущий процесс в очередь ожидания
+     *    - Перевести процесс в состояние SLEEPING (не потребляет CPU)
+     *    - Передать управление scheduler (context switch)
+     * 3. Процесс "спит" до вызова sem_post() другим процессом
+     * 
+     * В нашем случае:
+     * - Счётчик sem_done был 0
+     * - 0 - 1 = -1
+     * - -1 < 0 → родитель засыпает
+     * - Проснётся когда дочерний вызовет sem_post(sem_done)
+     * 
+     * Отличие от busy-wait:
+     * - while(flag) {} - CPU постоянно проверяет (100% загрузка)
+     * - sem_wait() - процесс спит (0% CPU)
+     * 
+     * Отличие от pause():
+     * - pause() - ждёт ЛЮБОГО сигнала (небезопасно)
+     * - sem_wait() - ждёт конкретного события (безопасно)
+     * ================================================================ */
+    /* sem_wait(done) до тех пор, пока буфер не вернётся к нам (DONE или MORE) */
+    return sem_wait_state(&shared->state, SLOT_DONE, SLOT_MORE, w->sem_done, w->map, w->map_size,
+                          w->backend == SHM_BACKEND_FILE);
+}
+
+/* slot_resume - SLOT_MORE: out[] выведен (или выброшен), дочерний продолжает тот же кусок */
+static void slot_resume(Worker *w, SharedData *shared) {
+    shared->out_size = 0;
+    if (w->ring) ring_set(&shared->state, SLOT_READY, &w->rs->child_sleeping);
+    else sem_set_state(&shared->state, SLOT_READY, w->sem_ready, w->map, w->map_size, w->backend == SHM_BACKEND_FILE);
+}
+
+/*
+ * worker_collect - дождаться результата куска и добавить его в пачку вывода
+ *
+ * Результат может прийти несколькими порциями (SHM_MORE), если out[]
+ * переполнился раньше, чем закончился кусок: такая порция выводится
+ * сразу (вместе с пачкой перед ней) - дочерний ждёт, пока out[] освободится.
+ * Дочерний завершился, не ответив, - сообщение и pool_broken.
+ */
+static void worker_collect(Worker *w) {
+    SharedData *shared = &w->slots[w->taken % w->nslots]; // Самый старый невыведенный кусок этого воркера
+    PhaseStats *st = &w->rs->stats;
+
+    shm_msync_ticks = &st->p_msync;
+
+    if (atomic_load_explicit(&shared->state, memory_order_relaxed) == SLOT_READY) {
+        w->stalls++;                         // Дочерний ещё считает - родителю придётся ждать
+    }
+
+    for (;;) {
+        unsigned long t0 = stat_ticks(), m0 = st->p_msync; // Ожидание - без msync внутри него
+        unsigned s = slot_wait(w, shared);
+        st->p_wait += stat_ticks() - t0 - (st->p_msync - m0);
+
+        if (s == SLOT_DEAD) {
+            safe_write(STDERR_FILENO, "Child exited unexpectedly\n", 26);
+            pool_broken = 1;
+            return;
+        }
+        if (s == SLOT_DONE && (shared->flags & SHM_FAILED)) { // --server: ошибка во входе, out[] - сообщение
+            if (!input_failed) {             // Первая ошибка файла: результаты до неё - на вывод, затем сообщение
+                out_flush();
+                safe_write(STDERR_FILENO, slot_out(w->rs, shared), shared->out_size);
+                input_failed = 1;
+                input_errors++;
+            }
+            out_add(NULL, 0, w);             // Слот освободит out_flush()
+            w->taken++;
+            return;
+        }
+        size_t size = input_failed ? 0 : shared->out_size; // После ошибки остаток файла не выводится
+        if (s == SLOT_DONE) {                // Кусок обработан целиком: слот освободит out_flush()
+            out_add(slot_out(w->rs, shared), size, w);
+            w->taken++;
+            return;
+        }
+
+        out_add(slot_out(w->rs, shared), size, NULL); // SLOT_MORE: вывести сейчас,
+        out_flush();                         // пачка перед порцией - тоже (порядок вывода)
+        slot_resume(w, shared);              // out[] выведен, продолжаем тот же кусок
+    }
+}
+
+/*
+ * collect_ready - вывести самый старый элемент очереди и всё, что готово за ним
+ *
+ * Первый элемент ждём (порядок вывода = порядок файла), следующие берём,
+ * пока они уже готовы, - и всё одним writev(). Элемент очереди - воркер
+ * или BATCH_TAG(k): заголовок k-го файла пакета (names). После pool_broken
+ * выводится только то, что уже собрано.
+ */
+static void collect_ready(Worker *workers, const int *queue, int *q_head, int *q_len, char **names) {
+    for (int first = 1; *q_len > 0; first = 0) {
+        int item = queue[*q_head];
+        if (item >= 0) {
+            if (!first && !worker_ready(&workers[item])) break;
+            worker_collect(&workers[item]);
+            if (pool_broken) break;
+        } else {
+            const char *name = names[-1 - item];
+            input_failed = 0;                // Ошибка прошлого файла пакета на этот не распространяется
+            out_add("==> ", 4, NULL);
+            out_add(name, strlen(name), NULL);
+            out_add(" <==\n", 5, NULL);
+        }
+        *q_head = (*q_head + 1) % QUEUE_LEN;
+        (*q_len)--;
+    }
+    out_flush();
+}
+
+/*
+ * submit_chunk - прочитать следующий кусок файла в слот воркера и отдать его
+ *
+ * carry/carry_len - хвост прошлого куска (начало незаконченной строки).
+ * *eof = 1, когда файл кончился (кусок ушёл с SHM_EOF); ошибка чтения
+ * считается концом файла и отмечается в *error.
+ * Возвращает 1, если строка не закончилась и следующий кусок должен
+ * получить тот же воркер ("липкий" кусок), иначе 0.
+ *
+ * --follow: неполный кусок - не конец файла. Отдаётся только до последнего
+ * '\n', незаконченная строка остаётся в carry до своего '\n'; если целых
+ * строк нет вовсе, ничего не отдаётся и возвращается -1 (пора ждать).
+ */
+static int submit_chunk(Worker *w, int file_fd, char *carry, size_t *carry_len, int *eof, int *error) {
+    char *in = slot_in(w->rs, worker_slot(w));
+
+    memcpy(in, carry, *carry_len);           // Начало строки из прошлого куска
+    unsigned long t0 = stat_ticks();
+    ssize_t bytes_read = read_full(file_fd, in + *carry_len, shm_cap - *carry_len); // Читаем до заполнения in[] или EOF
+    w->rs->stats.p_read += stat_ticks() - t0;
+
+    if (bytes_read < 0) {                    // Ошибка чтения: считаем это концом файла
+        safe_write(STDERR_FILENO, "Error reading file\n", 19);
+        bytes_read = 0;
+        *error = 1;
+        follow = 0;                          // Ждать дальше нечего
+    }
+
+    size_t total = *carry_len + (size_t)bytes_read;
+    size_t send = total;                     // Сколько байт отдаём в этом куске
+    int sticky = 0;                          // 1 = строка не закончилась, следующий кусок тому же воркеру
+
+    if (total < shm_cap && follow) {         // --follow: дочитали до текущего конца
+        while (send > 0 && in[send - 1] != '\n') send--;
+    } else if (total < shm_cap) {            // Неполный кусок = конец файла
+        *eof = 1;
+    } else {
+        while (send > 0 && in[send - 1] != '\n') send--; // Ищем последний '\n' с конца
+        if (send == 0) {                     // Строка длиннее всего буфера
+            send = total;
+            sticky = 1;
+        }
+    }
+
+    *carry_len = total - send;
+    memcpy(carry, in + send, *carry_len);
+    if (send == 0 && !*eof && !sticky) return -1; // --follow: целых строк нет, слот не занят
+
+    worker_dispatch(w, send, *eof ? SHM_EOF : 0);
+    return sticky;
+}
+
+/* is_binary - файл начинается с сигнатуры BIN_MAGIC (pipe: pread() не работает - текст) */
+static int is_binary(int fd) {
+    char magic[BIN_MAGIC_LEN];
+    return pread(fd, magic, BIN_MAGIC_LEN, 0) == BIN_MAGIC_LEN && memcmp(magic, BIN_MAGIC, BIN_MAGIC_LEN) == 0;
+}
+
+/* carry_buf - буфер хвоста строки не меньше cap байт (растёт вместе с in[]), NULL - нет памяти */
+static char *carry_buf(size_t cap) {
+    static char *buf = NULL;
+    static size_t buf_cap = 0;
+
+    if (cap > buf_cap) {
+        char *grown = realloc(buf, cap);
+        if (!grown) return NULL;
+        buf = grown;
+        buf_cap = cap;
+    }
+    return buf;
+}
+
+/*
+ * pool_grow - удвоить in[]/out[] всех воркеров: строка не влезла в in[]
+ *
+ * Вызывается, когда ни одного куска нет "в полёте". Не вышло (предел
+ * SHM_CAP_MAX, нет памяти) - работаем дальше с прежним shm_cap: длинная
+ * строка всё равно пройдёт "липкими" кусками. Воркер, который успел
+ * вырасти, просто не использует лишнее.
+ */
+static void pool_grow(Worker *workers, int nworkers) {
+    size_t cap = shm_cap * 2;
+
+    if (cap > SHM_CAP_MAX || !carry_buf(cap)) return;
+    for (int i = 0; i < nworkers; i++) {
+        if (worker_grow(&workers[i], cap) < 0) return;
+    }
+    shm_cap = cap;
+}
+
+/*
+ * bin_chunk_end - двоичный вход: конец куска строк, начинающегося с first
+ *
+ * Кусок - не больше out_cap / BIN_ROW_OUT строк (чтобы "Sum: ..." обычно
+ * влезали в out[] за раз) и не больше ~ZC_CHUNK байт чисел (чтобы длинные строки
+ * делились между воркерами так же ровно, как текст). Хотя бы одна строка -
+ * строку двоичного файла дочерний суммирует целиком, какой бы длинной она ни была.
+ * Индекс неубывающий, поэтому границу по объёму ищем двоичным поиском.
+ */
+static size_t bin_chunk_end(const BinHeader *bin, const char *input, size_t first) {
+    const uint64_t *index = (const uint64_t *)(input + bin->index_off);
+    size_t max_rows = shm_cap / BIN_ROW_OUT;
+    size_t hi = bin->rows - first > max_rows ? first + max_rows : bin->rows;
+    uint64_t limit = index[first] + ZC_CHUNK / bin->value_size;
+    size_t lo = first + 1;                   // Ответ в [lo, hi]
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (index[mid] <= limit) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* ============================================================================
+ * --follow: СЛЕЖЕНИЕ ЗА РАСТУЩИМ ФАЙЛОМ (как tail -f)
+ *
+ * Логи дописываются, и прогон с нуля каждый раз читает весь файл заново.
+ * С --follow уже записанное пропускается (follow_skip), а пул не
+ * завершается на конце файла: родитель засыпает в poll() на inotify
+ * (IN_MODIFY) и, проснувшись, читает read()-ом с текущей позиции - только
+ * дописанные байты. Работа пропорциональна новым данным, а не размеру файла.
+ *
+ * Незаконченная последняя строка не отдаётся: она ждёт в carry, пока не
+ * придёт её '\n' (submit_chunk). Перед сном всё, что "в полёте",
+ * забирается и выводится - результат строки появляется сразу.
+ *
+ * Остановка - SIGINT/SIGTERM: хвост файла дочитывается как обычно (и
+ * строка без '\n' в конце тоже получает свой "Sum:"), дочерние (в режиме
+ * --server) получают SHM_QUIT. Файл укоротили (ротация copytruncate) -
+ * начинаем с его начала.
+ * ============================================================================ */
+
+/*
+ * follow_start - наблюдение за файлом name и сигналы остановки
+ *
+ * Вызывается ДО первого read(): изменение, случившееся между чтением и
+ * сном, уже лежит в очереди inotify - проснёмся сразу, ничего не потеряв.
+ * SIGINT/SIGTERM блокируются до запуска пула (потоки --inproc наследуют
+ * маску, и сигнал не уйдёт к ним) и читаются через signalfd в том же
+ * poll(). Возвращает 0 или -1 (сообщение уже выведено).
+ */
+static int follow_start(const char *name) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+
+    follow_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follow_watch < 0 || inotify_add_watch(follow_watch, name, IN_MODIFY) < 0) {
+        safe_write(STDERR_FILENO, "Cannot watch file\n", 18);
+        return -1;
+    }
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    follow_sig = signalfd(-1, &set, SFD_CLOEXEC);
+    if (follow_sig < 0) {
+        safe_write(STDERR_FILENO, "signalfd error\n", 15);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * follow_skip - начать слежение с конца файла (как tail -f без истории)
+ *
+ * Уже записанные строки не разбираются: позиция ставится сразу за
+ * последним '\n'. Незаконченная последняя строка (писатель ещё дописывает
+ * её) читается целиком - иначе её конец выглядел бы отдельной строкой.
+ * Вызывается после follow_start: дописанное во время поиска не потеряется.
+ */
+static void follow_skip(int file_fd) {
+    char buf[4096];
+    struct stat st;
+    if (fstat(file_fd, &st) < 0) return;
+
+    off_t end = st.st_size;
+    while (end > 0) {                        // Ищем '\n' блоками с конца файла
+        off_t from = end > (off_t)sizeof(buf) ? end - (off_t)sizeof(buf) : 0;
+        ssize_t n = pread(file_fd, buf, (size_t)(end - from), from);
+        if (n <= 0) break;
+        char *nl = memrchr(buf, '\n', (size_t)n);
+        if (nl) {
+            lseek(file_fd, from + (nl - buf) + 1, SEEK_SET);
+            return;
+        }
+        end = from;
+    }
+    lseek(file_fd, 0, SEEK_SET);             // Ни одной целой строки - читаем с начала
+}
+
+/* follow_stop - закрыть inotify и signalfd (-1 - не открывались) */
+static void follow_stop(void) {
+    if (follow_watch >= 0) close(follow_watch);
+    if (follow_sig >= 0) close(follow_sig);
+    follow_watch = follow_sig = -1;
+}
+
+/*
+ * follow_wait - уснуть, пока файл не изменится или не придёт сигнал
+ *
+ * Возвращает 1 - в файле могли появиться новые байты, 0 - пора остановиться.
+ * Файл стал короче прочитанного - читаем заново с начала, а carry (начало
+ * строки из старого содержимого) выбрасываем.
+ */
+static int follow_wait(int file_fd, size_t *carry_len) {
+    struct pollfd pfd[2] = {{follow_sig, POLLIN, 0}, {follow_watch, POLLIN, 0}};
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (pfd[0].revents) return 0;        // SIGINT/SIGTERM: остановка
+        if (pfd[1].revents) break;
+    }
+    while (read(follow_watch, events, sizeof(events)) > 0) {} // Важен сам факт изменения, не события
+
+    struct stat st;
+    off_t pos = lseek(file_fd, 0, SEEK_CUR);
+    if (fstat(file_fd, &st) == 0 && pos > st.st_size) {
+        safe_write(STDERR_FILENO, "File truncated, following from the start\n", 41);
+        lseek(file_fd, 0, SEEK_SET);
+        *carry_len = 0;
+    }
+    return 1;
+}
+
+/*
+ * run_file - передать пулу один файл и вывести результаты
+ *
+ * input != NULL (--zero-copy) - файл уже отображён в память: вместо
+ * read() в in[] воркерам уходят только границы кусков (SHM_RANGE), а
+ * данные дочерние читают из СВОЕГО отображения того же файла. Родитель
+ * касается лишь страниц на границах кусков (поиск '\n').
+ *
+ * bin != NULL - файл двоичный (txt2bin, всегда отображён): границы кусков -
+ * номера строк (SHM_RANGE | SHM_BINARY), дочерние суммируют массивы чисел.
+ *
+ * follow (--follow) - на конце файла ждать дописанного (follow_wait), пока
+ * не придёт сигнал остановки.
+ *
+ * Возвращает 0 при успехе, -1 при ошибке чтения файла. Даже при ошибке
+ * все воркеры получают SHM_EOF и все результаты забираются, поэтому
+ * пул остаётся в согласованном состоянии (важно для демона). Исключение -
+ * pool_broken: обмен обрывается сразу (-1), воркеров остаётся только убить.
+ */
+static int run_file(Worker *workers, int nworkers, int file_fd, const char *input, size_t input_size,
+                    const BinHeader *bin) {
+    char *carry = carry_buf(shm_cap);        // Хвост предыдущего куска (неполная строка)
+    size_t carry_len = 0;
+    static int queue[QUEUE_LEN];             // FIFO воркеров в порядке выдачи кусков
+    int q_head = 0, q_len = 0;
+    int next = 0;                            // Кому отдать следующий кусок
+    int eof = 0;                             // Файл прочитан до конца
+    int error = 0;                           // Была ошибка чтения
+    size_t offset = 0;                       // --zero-copy: начало следующего куска в файле
+    int grow = 0;                            // Строка не влезла в in[] - вырастить буферы
+
+    if (!carry) {
+        safe_write(STDERR_FILENO, "Out of memory\n", 14);
+        return -1;                           // Воркеры ничего не получали - пул согласован
+    }
+
+    /* ====================================================================
+     * ПОТОКОВЫЙ ОБМЕН: файл передаётся кусками по shm_cap байт
+     *
+     * Раньше файл читался одним read() в буфер 8 КБ, и всё, что
+     * не поместилось, молча терялось. Теперь родитель перезаполняет
+     * in[] кусок за куском, пока не встретит конец файла, поэтому
+     * размер входа ограничен только диском, а память - размером области.
+     *
+     * Раздача по воркерам (-j N):
+     * - Каждый кусок обрезается по последнему '\n'; хвост (начало
+     *   следующей строки) переносится в начало следующего куска.
+     *   Так любой кусок содержит только целые строки, и его можно
+     *   отдать любому воркеру.
+     * - Куски раздаются по кругу: 0, 1, ..., N-1, 0, ...
+     * - Результаты забираются в том же порядке (FIFO), поэтому строки
+     *   "Sum:" выводятся в порядке исходного файла.
+     * - Пока родитель ждёт самый старый кусок, остальные N-1 воркеров
+     *   уже считают свои - отсюда параллелизм.
+     * - Строка длиннее shm_cap целиком не помещается; её куски
+     *   отдаются ОДНОМУ воркеру подряд, а он склеивает их сам (как в
+     *   однопроцессном режиме). Заодно буферы всех воркеров удваиваются
+     *   (pool_grow), как только заберём всё "в полёте", - следующие
+     *   длинные строки пройдут целиком.
+     * - С --ring у каждого воркера RING_SLOTS слотов, поэтому "в полёте"
+     *   до N * RING_SLOTS кусков; порядок вывода тот же (FIFO).
+     * ==================================================================== */
+    for (int i = 0; i < nworkers; i++) workers[i].eof_sent = 0; // Демон: новый файл - новый SHM_EOF
+    input_failed = 0;
+
+    if (bin && bin->rows == 0) eof = 1;     // Пустой двоичный файл: кусков нет, только SHM_EOF ниже
+
+    while ((!eof || q_len > 0) && !pool_broken) {
+        /* Раздаём куски всем свободным воркерам по очереди */
+        while (!eof && worker_can_submit(&workers[next])) {
+            Worker *w = &workers[next];
+
+            if (bin) {                       // Двоичный вход: offset - номер строки
+                size_t end = bin_chunk_end(bin, input, offset);
+                eof = (end == bin->rows);
+
+                worker_slot(w)->in_off = offset;
+                worker_dispatch(w, end - offset, SHM_RANGE | SHM_BINARY | (eof ? SHM_EOF : 0));
+                queue[(q_head + q_len) % QUEUE_LEN] = next;
+                q_len++;
+
+                offset = end;
+                next = (next + 1) % nworkers;
+                continue;
+            }
+
+            if (input) {                     // --zero-copy: кусок ~ZC_CHUNK байт до ближайшего '\n'
+                size_t end = offset + ZC_CHUNK;
+                if (end >= input_size) {
+                    end = input_size;
+                } else {
+                    const char *nl = memchr(input + end, '\n', input_size - end);
+                    end = nl ? (size_t)(nl - input) + 1 : input_size;
+                }
+                eof = (end == input_size);
+
+                worker_slot(w)->in_off = offset;
+                worker_dispatch(w, end - offset, SHM_RANGE | (eof ? SHM_EOF : 0));
+                queue[(q_head + q_len) % QUEUE_LEN] = next;
+                q_len++;
+
+                offset = end;
+                next = (next + 1) % nworkers; // Строки не режутся - "липких" кусков не бывает
+                continue;
+            }
+
+            if (grow && q_len > 0) break;    // Расти можно только со свободными слотами
+            if (grow) {
+                pool_grow(workers, nworkers);
+                carry = carry_buf(shm_cap);  // carry_len == 0: липкий кусок ушёл целиком
+                grow = 0;
+            }
+
+            int sticky = submit_chunk(w, file_fd, carry, &carry_len, &eof, &error);
+            if (sticky < 0) {                // --follow: новых целых строк пока нет
+                while (q_len > 0 && !pool_broken) collect_ready(workers, queue, &q_head, &q_len, NULL); // Всё "в полёте" - на вывод до сна
+                if (pool_broken || input_failed) break; // Ошибка во входе - не ждём дальше
+                if (!follow_wait(file_fd, &carry_len)) follow = 0; // Остановка: дочитать как обычный файл
+                continue;
+            }
+            queue[(q_head + q_len) % QUEUE_LEN] = next;
+            q_len++;
+
+            if (!sticky) next = (next + 1) % nworkers;
+            grow = sticky && !eof && shm_cap < SHM_CAP_MAX;
+        }
+
+        /* Забираем самый старый результат (и готовые за ним) - порядок вывода = порядок файла */
+        collect_ready(workers, queue, &q_head, &q_len, NULL);
+        if (input_failed) eof = 1;           // Ошибка во входе: дальше не читаем, только SHM_EOF ниже
+    }
+
+    /* Воркеры, не получившие последний кусок, получают пустой кусок с SHM_EOF */
+    for (int i = 0; i < nworkers && !pool_broken; i++) {
+        if (!workers[i].eof_sent) {
+            worker_dispatch(&workers[i], 0, SHM_EOF);
+            worker_collect(&workers[i]);
+        }
+    }
+    out_flush();
+
+    return error || pool_broken || input_failed ? -1 : 0;
+}
+
+/*
+ * run_batch - пакетный режим: много файлов за один запуск
+ *
+ * Пул дочерних (в режиме --server) запускается один раз на весь пакет.
+ * Файлы идут в ОДНОМ потоке кусков без барьеров между ними: последний
+ * кусок файла k уходит с SHM_EOF (дочерний сбрасывает хвост строки), и
+ * родитель сразу читает файл k+1, пока воркеры ещё считают файл k.
+ * Заголовок "==> имя <==" - отдельный элемент FIFO (BATCH_TAG), поэтому
+ * он выводится ровно между результатами соседних файлов.
+ * Возвращает 0, или 1 если какой-то файл не удалось открыть/прочитать
+ * (или пул сломался - pool_broken).
+ */
+static int run_batch(Worker *workers, int nworkers, char **names, int count) {
+    char *carry = carry_buf(shm_cap);        // Хвост предыдущего куска (неполная строка)
+    size_t carry_len = 0;
+    static int queue[QUEUE_LEN];             // FIFO: воркеры и заголовки файлов в порядке вывода
+    int q_head = 0, q_len = 0;
+    int next = 0;                            // Кому отдать следующий кусок
+    int k = 0;                               // Следующий файл пакета
+    int file_fd = -1;                        // Текущий файл
+    int eof = 1;                             // Текущий файл прочитан (1 = пора открыть следующий)
+    int error = 0;                           // Был файл с ошибкой
+    int grow = 0;                            // Строка не влезла в in[] - вырастить буферы (см. run_file)
+
+    if (!carry) {
+        safe_write(STDERR_FILENO, "Out of memory\n", 14);
+        return 1;
+    }
+
+    while ((k < count || !eof || q_len > 0) && !pool_broken) {
+        while (q_len < QUEUE_LEN) {
+            if (eof) {                       // Переход к следующему файлу - без ожидания воркеров
+                if (file_fd >= 0) close(file_fd);
+                file_fd = -1;
+                if (k == count) break;
+
+                queue[(q_head + q_len) % QUEUE_LEN] = BATCH_TAG(k);
+                q_len++;
+                file_fd = open(names[k++], O_RDONLY | O_CLOEXEC);
+                if (file_fd < 0) {
+                    safe_write(STDERR_FILENO, "Cannot open file\n", 17);
+                    error = 1;
+                    continue;                // eof остаётся 1 - сразу следующий файл
+                }
+                if (is_binary(file_fd)) {    // Пул пакета уже запущен без отображения файла
+                    safe_write(STDERR_FILENO, "Binary input is not supported in batch mode\n", 44);
+                    error = 1;
+                    continue;
+                }
+                eof = 0;
+                carry_len = 0;
+            }
+
+            if (!worker_can_submit(&workers[next])) break;
+            if (grow && q_len > 0) break;    // Расти можно только со свободными слотами
+            if (grow) {
+                pool_grow(workers, nworkers);
+                carry = carry_buf(shm_cap);
+                grow = 0;
+            }
+
+            int sticky = submit_chunk(&workers[next], file_fd, carry, &carry_len, &eof, &error);
+            queue[(q_head + q_len) % QUEUE_LEN] = next;
+            q_len++;
+
+            if (!sticky) next = (next + 1) % nworkers;
+            grow = sticky && !eof && shm_cap < SHM_CAP_MAX;
+        }
+
+        /* Забираем самый старый элемент (результат куска или заголовок файла) и готовые за ним */
+        collect_ready(workers, queue, &q_head, &q_len, names);
+    }
+    if (file_fd >= 0) close(file_fd);        // Обмен оборвался посреди файла
+
+    return error || pool_broken || input_errors > 0;
+}
+
+/*
+ * read_list - список файлов пакета: по одному имени на строку
+ *
+ * Читает fd (stdin или файл-манифест) целиком, пустые строки пропускает.
+ * Возвращает массив указателей в *buf (освобождать оба через free())
+ * или NULL при ошибке.
+ */
+static char **read_list(int fd, char **buf, int *count) {
+    size_t cap = 4096, len = 0;
+    char *data = malloc(cap);
+    if (!data) return NULL;
+
+    for (;;) {
+        if (len + 1 == cap) {                // Место под очередной read() и '\0'
+            char *grown = realloc(data, cap * 2);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, data + len, cap - 1 - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(data);
+            return NULL;
+        }
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+    data[len] = '\0';
+
+    size_t lines = 1;                        // Верхняя оценка числа имён
+    for (size_t i = 0; i < len; i++) lines += (data[i] == '\n');
+
+    char **names = malloc(lines * sizeof(char *));
+    if (!names) {
+        free(data);
+        return NULL;
+    }
+
+    int n = 0;
+    char *p = data;
+    while (*p) {
+        char *nl = strchr(p, '\n');
+        if (nl) *nl = '\0';
+        if (*p) names[n++] = p;              // Пустые строки пропускаем
+        if (!nl) break;
+        p = nl + 1;
+    }
+
+    *buf = data;
+    *count = n;
+    return names;
+}
+
+/*
+ * open_input - запрос имени файла у пользователя и открытие файла
+ *
+ * name != NULL - имя уже задано в командной строке: не спрашиваем.
+ *
+ * filename - буфер BUF_SIZE байт под имя (оно нужно ещё --follow для inotify).
+ * Возвращает дескриптор файла или -1 (сообщение уже выведено).
+ */
+static int open_input(char *filename, const char *name) {
+    if (name) {
+        size_t n = strlen(name);
+        if (n >= BUF_SIZE) {                 // Как и при вводе: не длиннее буфера имени
+            safe_write(STDERR_FILENO, "Cannot open file\n", 17);
+            return -1;
+        }
+        memcpy(filename, name, n + 1);       // Вместе с '\0'
+    } else {
+        safe_write(STDOUT_FILENO, "Enter filename: ", 16); // STDOUT_FILENO = 1 (стандартный вывод)
+
+        ssize_t len = read(STDIN_FILENO, filename, BUF_SIZE - 1); // STDIN_FILENO = 0, читаем до 255 байт (резервируем место для '\0')
+        if (len <= 0) {                      // Ошибка чтения (EOF или ошибка)
+            safe_write(STDERR_FILENO, "Error reading filename\n", 23); // STDERR_FILENO = 2 (стандартный поток ошибок)
+            return -1;
+        }
+        filename[len] = '\0';                // read() не завершает строку нулём
+
+        char *newline = strchr(filename, '\n'); // strchr() ищет первое вхождение '\n', возвращает указатель или NULL
+        if (newline) *newline = '\0';        // Заменяем '\n' на '\0' (нуль-терминатор C-строки)
+    }
+
+    int file_fd = open(filename, O_RDONLY | O_CLOEXEC); // O_RDONLY - только для чтения, O_CLOEXEC - дочерние не наследуют
+    if (file_fd < 0) {
+        safe_write(STDERR_FILENO, "Cannot open file\n", 17);
+        return -1;
+    }
+    return file_fd;
+}
+
+/* ============================================================================
+ * ЗАМОК ПУЛА ДЕМОНА: flock() на объекте SHM_LOCK
+ *
+ * Раньше пул охранял именованный семафор: клиент, убитый SIGKILL посреди
+ * файла, так и не делал sem_post - все следующие клиенты ждали вечно, а
+ * дочерние оставались посреди чужого файла (полстроки в ParseState, слоты
+ * READY/MORE/DONE). Замок flock() ядро снимает само, когда владелец умирает.
+ *
+ * Но и пул после такого клиента брать нельзя, пока его не привели в
+ * порядок. Поэтому в самом объекте - DaemonLock: клиент, взяв замок,
+ * пишет в owner свой PID и стирает его, закончив. Свободный замок с
+ * ненулевым owner значит "клиент умер посреди файла": клиент такой пул
+ * не берёт (отпускает замок и ждёт), а демон раз в SHM_ALIVE_MS смотрит
+ * на owner, сам берёт замок, чинит воркеров (daemon_reset) и обнуляет
+ * owner - только после этого пул достаётся следующему клиенту.
+ * ============================================================================ */
+/*
+ * daemon_reset - вернуть воркера к началу файла после умершего клиента
+ *
+ * Позиция кольца - rs->next_seq (worker_dispatch обновляет её на каждом
+ * куске, так что она верна и после SIGKILL клиента). Куски "в полёте"
+ * дорабатываются, их вывод выбрасывается; затем пустой кусок с SHM_EOF
+ * сбрасывает недоразобранную строку дочернего (ParseState) - её результат
+ * тоже выбрасывается. Возвращает 0 или -1 (дочерний завершился).
+ */
+static int daemon_reset(Worker *w) {
+    unsigned long seq = w->rs->next_seq;
+
+    /* Клиент мог умереть между SLOT_READY и "звонком" - будим дочернего сами (лишний звонок безвреден) */
+    if (w->ring) {
+        for (unsigned i = 0; i < w->nslots; i++) {
+            syscall(SYS_futex, (unsigned *)&w->slots[i].state, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        }
+    } else {
+        sem_post(w->sem_ready);
+    }
+
+    for (unsigned long k = seq > w->nslots ? seq - w->nslots : 0; k < seq; k++) { // В полёте - не больше nslots
+        SharedData *shared = &w->slots[k % w->nslots];
+        unsigned s = atomic_load_explicit(&shared->state, memory_order_acquire);
+        while (s == SLOT_READY || s == SLOT_MORE) {
+            if (s == SLOT_MORE) slot_resume(w, shared); // Вывод умершего клиента никому не нужен
+            s = slot_wait(w, shared);
+            if (s == SLOT_DEAD) return -1;
+        }
+        atomic_store_explicit(&shared->state, SLOT_FREE, memory_order_relaxed); // DONE (или уже FREE)
+    }
+
+    w->submitted = w->taken = w->collected = seq;
+    SharedData *shared = worker_slot(w);
+    worker_dispatch(w, 0, SHM_EOF);          // Сбросить хвост строки
+    unsigned s;
+    while ((s = slot_wait(w, shared)) == SLOT_MORE) slot_resume(w, shared);
+    if (s == SLOT_DEAD) return -1;
+    atomic_store_explicit(&shared->state, SLOT_FREE, memory_order_relaxed);
+    w->taken = w->collected = w->submitted;
+    return 0;
+}
+
+/*
+ * run_daemon - долгоживущий пул (parent --daemon)
+ *
+ * Обычный запуск платит за fork + execv + создание семафоров и mmap на
+ * КАЖДЫЙ файл; для маленьких файлов это дороже самой обработки. Демон
+ * создаёт пул один раз, а клиенты (parent --client) только подключаются
+ * к его shm-объектам по именам и прогоняют через них свои файлы.
+ *
+ * Клиенты обслуживаются по одному (замок SHM_LOCK, см. выше). Пока пул
+ * запускается, замок держит сам демон. Дальше он спит в sigtimedwait()
+ * и раз в SHM_ALIVE_MS проверяет дочерних (завершился - демон
+ * останавливается) и владельца замка (умер - daemon_reset). Остановка
+ * по SIGINT/SIGTERM: демон дожидается текущего клиента (не дольше
+ * DAEMON_STOP_TIMEOUT секунд), шлёт каждому дочернему SHM_QUIT и удаляет
+ * все IPC-объекты. Оставшиеся от убитого прошлого демона убирает daemon_sweep.
+ */
+static int run_daemon(Worker *workers, int nworkers, int ring) {
+    int lock_fd = shm_open(SHM_LOCK, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (lock_fd < 0 && errno == EEXIST && daemon_sweep()) { // Прошлый демон убит - его объекты убраны
+        lock_fd = shm_open(SHM_LOCK, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (lock_fd < 0) {
+        safe_write(STDERR_FILENO, "Daemon already running\n", 23);
+        return 1;
+    }
+    flock(lock_fd, LOCK_EX);                 // Клиенты ждут, пока пул не запущен
+
+    DaemonLock *lk = MAP_FAILED;
+    if (ftruncate(lock_fd, sizeof(DaemonLock)) == 0) { // Новые байты - нули: daemon = owner = 0
+        lk = mmap(NULL, sizeof(DaemonLock), PROT_READ | PROT_WRITE, MAP_SHARED, lock_fd, 0);
+    }
+    int started = 0;
+    if (lk != MAP_FAILED) {
+        while (started < nworkers && worker_start(&workers[started], started, ring, SHM_BACKEND_POSIX, 1, -1) == 0) {
+            started++;
+        }
+    } else {
+        safe_write(STDERR_FILENO, "mmap error\n", 11);
+    }
+    if (started < nworkers) {
+        for (int i = 0; i < started; i++) worker_destroy(&workers[i], 1);
+        if (lk != MAP_FAILED) munmap(lk, sizeof(DaemonLock));
+        close(lock_fd);
+        shm_unlink(SHM_LOCK);
+        return 1;
+    }
+
+    /* Сигналы блокируем и принимаем синхронно через sigtimedwait() - без обработчиков */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigprocmask(SIG_BLOCK, &set, NULL);      // После fork: дочерние сигналы не блокируют
+
+    lk->daemon = getpid();
+    flock(lock_fd, LOCK_UN);                 // Пул готов - впускаем клиентов
+    safe_write(STDOUT_FILENO, "Daemon ready\n", 13);
+
+    struct timespec tick = {SHM_ALIVE_MS / 1000, (SHM_ALIVE_MS % 1000) * 1000000L};
+    int broken = 0;                          // Дочерний завершился - пул не починить
+    while (sigtimedwait(&set, NULL, &tick) < 0) { // Спим до Ctrl+C / kill
+        if (errno != EAGAIN) continue;       // EINTR
+        for (int i = 0; i < nworkers; i++) broken |= !worker_alive(&workers[i]);
+        if (broken) break;
+
+        pid_t owner = lk->owner;
+        if (owner == 0 || pid_alive(owner)) continue; // Пул свободен или клиент работает
+        while (flock(lock_fd, LOCK_EX) < 0 && errno == EINTR) {} // Замок умершего ядро уже сняло
+        if (lk->owner == owner) {            // Пока ждали, никто другой пул не чинил
+            for (int i = 0; i < nworkers && !broken; i++) broken = daemon_reset(&workers[i]) < 0;
+            if (!broken) lk->owner = 0;
+        }
+        flock(lock_fd, LOCK_UN);
+        if (broken) break;
+    }
+    if (broken) safe_write(STDERR_FILENO, "Child exited, stopping daemon\n", 30);
+
+    /* Ждём, пока текущий клиент (если есть) отпустит пул */
+    struct timespec now, deadline, pause = {0, DAEMON_RETRY_NS};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += DAEMON_STOP_TIMEOUT;
+    int clean = 0;                           // Замок наш и пул согласован - штатная остановка
+    while (!broken) {
+        if (flock(lock_fd, LOCK_EX | LOCK_NB) == 0) {
+            clean = (lk->owner == 0);        // Иначе клиент умер, а починить не успели
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) break;
+        nanosleep(&pause, NULL);
+    }
+    lk->stopping = 1;                        // Ждущие замка клиенты не пойдут в удалённый пул
+
+    for (int i = 0; i < nworkers; i++) {
+        Worker *w = &workers[i];
+        if (clean) {                         // Пул свободен - штатная остановка
+            w->submitted = w->taken = w->collected = w->rs->next_seq; // Слот, следующий за последним клиентом
+            worker_dispatch(w, 0, SHM_QUIT); // Ответа не будет - дочерний просто выходит
+        }
+        worker_destroy(w, !clean);           // Клиент завис или пул сломан - завершаем дочерних сигналом
+    }
+
+    munmap(lk, sizeof(DaemonLock));
+    close(lock_fd);
+    shm_unlink(SHM_LOCK);
+    return broken;
+}
+
+/*
+ * daemon_lock - клиент: взять замок пула, когда пул готов и согласован
+ *
+ * Пока демон запускает пул, flock() просто ждёт. Прошлый клиент умер
+ * посреди файла (owner != 0) - отпускаем замок и пробуем снова через
+ * DAEMON_RETRY_NS: пул чинит демон. Демона нет (остановлен, убит или так
+ * и не запустил пул) - NULL с сообщением. Иначе - DaemonLock (замок
+ * взят, дескриптор в *fd).
+ */
+static DaemonLock *daemon_lock(int *fd) {
+    struct timespec pause = {0, DAEMON_RETRY_NS};
+
+    for (int tries = 0; tries < DAEMON_RETRIES; tries++, nanosleep(&pause, NULL)) {
+        *fd = shm_open(SHM_LOCK, O_RDWR, 0); // Без O_CREAT: демон должен уже работать
+        if (*fd < 0) break;
+
+        struct stat st;
+        DaemonLock *lk = MAP_FAILED;
+        if (fstat(*fd, &st) == 0 && (size_t)st.st_size >= sizeof(DaemonLock)) { // Демон мог ещё не сделать ftruncate
+            lk = mmap(NULL, sizeof(DaemonLock), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+        }
+        if (lk == MAP_FAILED) {
+            close(*fd);
+            continue;
+        }
+
+        while (flock(*fd, LOCK_EX) < 0 && errno == EINTR) {} // Ждём своей очереди (и запуска пула)
+        if (lk->daemon > 0 && !lk->stopping && lk->owner == 0 && pid_alive(lk->daemon)) return lk; // Пул наш
+
+        pid_t daemon = lk->daemon;
+        int stopping = lk->stopping;
+        flock(*fd, LOCK_UN);
+        munmap(lk, sizeof(DaemonLock));
+        close(*fd);
+        if (stopping || (daemon > 0 && !pid_alive(daemon))) break; // Остановлен или убит
+        if (daemon > 0) tries = 0;           // Живой демон чинит пул - ждём сколько нужно
+    }
+    safe_write(STDERR_FILENO, "Daemon is not running\n", 22);
+    return NULL;
+}
+
+/*
+ * run_client - отдать один файл работающему демону (parent --client)
+ *
+ * Воркеры демона находятся по именам: 0, 1, ... пока shm_open() успешен.
+ */
+static int run_client(Worker *workers) {
+    int lock_fd = shm_open(SHM_LOCK, O_RDONLY, 0); // Демона нет - сообщаем до вопроса об имени файла
+    if (lock_fd < 0) {
+        safe_write(STDERR_FILENO, "Daemon is not running\n", 22);
+        return 1;
+    }
+    close(lock_fd);
+
+    char filename[BUF_SIZE];                 // Имя входного файла
+    int file_fd = open_input(filename, NULL);
+    if (file_fd < 0) return 1;
+    if (is_binary(file_fd)) {                // Воркеры демона не отображают файлы клиентов
+        safe_write(STDERR_FILENO, "Binary input is not supported by the daemon\n", 44);
+        close(file_fd);
+        return 1;
+    }
+
+    DaemonLock *lk = daemon_lock(&lock_fd);  // Ждём своей очереди
+    if (!lk) {
+        close(file_fd);
+        return 1;
+    }
+    lk->owner = getpid();                    // Умрём посреди файла - демон увидит и починит пул
+
+    int nworkers = 0;
+    while (nworkers < MAX_WORKERS && worker_attach(&workers[nworkers], nworkers) == 0) nworkers++;
+    if (nworkers > 0) shm_cap = workers[0].rs->in_cap; // Ёмкость задал демон (и, может, нарастили прошлые клиенты)
+    for (int i = 1; i < nworkers; i++) {
+        if (workers[i].rs->in_cap < shm_cap) shm_cap = workers[i].rs->in_cap;
+    }
+
+    int rc = 1;
+    if (nworkers == 0) {
+        safe_write(STDERR_FILENO, "Cannot attach to daemon\n", 24);
+    } else {
+        safe_write(STDOUT_FILENO, "Result:\n", 8);
+        rc = run_file(workers, nworkers, file_fd, NULL, 0, NULL) < 0;
+    }
+
+    /* Позицию кольца следующему клиенту передаёт rs->next_seq (её ведёт worker_dispatch) */
+    for (int i = 0; i < nworkers; i++) worker_destroy(&workers[i], 0); // attached: только закрываем
+
+    if (!pool_broken) lk->owner = 0;         // Пул согласован (сломанный - пусть разбирается демон)
+    flock(lock_fd, LOCK_UN);
+    munmap(lk, sizeof(DaemonLock));
+    close(lock_fd);
+    close(file_fd);
+    return rc;
+}
+
+/*
+ * print_stalls - счётчики простоев (--stalls), по строке на воркер в stderr
+ *
+ * parent - сколько раз родитель ждал результат, потому что воркер ещё
+ * считал (упор в вычисления); child - сколько раз дочерний ждал кусок,
+ * потому что родитель ещё читал файл (упор в ввод-вывод). Вызывать,
+ * когда дочерние уже завершились или ждут SHM_QUIT.
+ */
+static void print_stalls(const Worker *workers, int nworkers) {
+    for (int i = 0; i < nworkers; i++) {
+        char line[128];                      // "Worker N: parent stalls X, child stalls Y\n"
+        size_t len = 0;
+
+        memcpy(line, "Worker ", 7);
+        len = 7;
+        len += format_uint(line + len, (unsigned long)i);
+        memcpy(line + len, ": parent stalls ", 16);
+        len += 16;
+        len += format_uint(line + len, workers[i].stalls);
+        memcpy(line + len, ", child stalls ", 15);
+        len += 15;
+        len += format_uint(line + len, workers[i].rs->child_stalls);
+        line[len++] = '\n';
+        safe_write(STDERR_FILENO, line, len);
+    }
+}
+
+/* put_str - дописать строку без '\0', возвращает длину (для сводки --stats) */
+static size_t put_str(char *dst, const char *src) {
+    size_t len = strlen(src);
+    memcpy(dst, src, len);
+    return len;
+}
+
+/* format_milli - value / 1000 с тремя знаками после точки: 12345 -> "12.345" */
+static size_t format_milli(char *dst, unsigned long value) {
+    size_t len = format_uint(dst, value / 1000);
+    dst[len++] = '.';
+    dst[len++] = (char)('0' + value / 100 % 10);
+    dst[len++] = (char)('0' + value / 10 % 10);
+    dst[len++] = (char)('0' + value % 10);
+    return len;
+}
+
+/* put_ms - " <name> 12.345 ms": тики -> миллисекунды */
+static size_t put_ms(char *dst, const char *name, unsigned long ticks, double ns_per_tick) {
+    size_t len = put_str(dst, name);
+    dst[len++] = ' ';
+    len += format_milli(dst + len, (unsigned long)((double)ticks * ns_per_tick / 1000.0)); // В микросекундах
+    return len + put_str(dst + len, " ms");
+}
+
+/*
+ * print_stats - сводка счётчиков фаз (--stats) в stderr
+ *
+ * По строке на воркер: где провёл время родитель (чтение файла, вывод,
+ * msync, ожидание дочернего) и дочерний (обработка с разбивкой на разбор
+ * и форматирование, ожидание, msync), объёмы и простои (как --stalls).
+ * Итог - пропускная способность по времени от создания пула.
+ * Вызывать, когда дочерние уже завершились или ждут SHM_QUIT.
+ */
+static void print_stats(const Worker *workers, int nworkers) {
+    unsigned long bytes = 0, lines = 0;
+    double ns_per_tick = stat_ns_per_tick(&workers[0].rs->stats);
+    unsigned long wall_us = (stat_ns() - workers[0].rs->stats.t0_ns) / 1000;
+
+    for (int i = 0; i < nworkers; i++) {
+        const PhaseStats *st = &workers[i].rs->stats;
+        char line[512];
+        size_t len = put_str(line, "Worker ");
+
+        len += format_uint(line + len, (unsigned long)i);
+        len += put_ms(line + len, ": parent read", st->p_read, ns_per_tick);
+        len += put_ms(line + len, ", write", st->p_write, ns_per_tick);
+        len += put_ms(line + len, ", msync", st->p_msync, ns_per_tick);
+        len += put_ms(line + len, ", wait", st->p_wait, ns_per_tick);
+        len += put_ms(line + len, "; child busy", st->c_busy, ns_per_tick);
+        len += put_ms(line + len, " (parse", st->c_parse, ns_per_tick);
+        len += put_ms(line + len, ", format", st->c_format, ns_per_tick);
+        len += put_ms(line + len, "), wait", st->c_wait, ns_per_tick);
+        len += put_ms(line + len, ", msync", st->c_msync, ns_per_tick);
+        len += put_str(line + len, "; ");
+        len += format_uint(line + len, st->c_bytes);
+        len += put_str(line + len, " bytes, ");
+        len += format_uint(line + len, st->c_lines);
+        len += put_str(line + len, " lines, ");
+        len += format_uint(line + len, st->p_chunks);
+        len += put_str(line + len, " chunks, stalls ");
+        len += format_uint(line + len, workers[i].stalls);
+        line[len++] = '/';
+        len += format_uint(line + len, workers[i].rs->child_stalls);
+        line[len++] = '\n';
+        safe_write(STDERR_FILENO, line, len);
+
+        bytes += st->c_bytes;
+        lines += st->c_lines;
+    }
+
+    char line[128];                          // "Total: 12.345 ms, 130.123 MB/s, 1900000 lines/s\n"
+    size_t len = put_str(line, "Total: ");
+    if (wall_us == 0) wall_us = 1;
+    len += format_milli(line + len, wall_us);
+    len += put_str(line + len, " ms, ");
+    len += format_milli(line + len, (unsigned long)((double)bytes * 1000.0 / (double)wall_us)); // Байт/мкс = MB/s
+    len += put_str(line + len, " MB/s, ");
+    len += format_uint(line + len, (unsigned long)((double)lines * 1e6 / (double)wall_us));
+    len += put_str(line + len, " lines/s\n");
+    safe_write(STDERR_FILENO, line, len);
+}
+
+/*
+ * main_batch - пакетный режим (имена в argv, --batch или --manifest)
+ *
+ * Один пул на весь пакет: семафоры, отображения и дочерние создаются один
+ * раз вместо запуска parent на каждый файл из shell-цикла.
+ */
+static int main_batch(Worker *workers, int nworkers, int ring, int backend, int stalls,
+                      char **names, int count, int batch_stdin, const char *manifest) {
+    char **list = NULL;                      // Список из stdin/манифеста
+    char *list_buf = NULL;                   // Его текст (имена указывают внутрь)
+
+    if (batch_stdin || manifest) {
+        int list_fd = STDIN_FILENO;
+        if (manifest) {
+            list_fd = open(manifest, O_RDONLY | O_CLOEXEC);
+            if (list_fd < 0) {
+                safe_write(STDERR_FILENO, "Cannot open manifest\n", 21);
+                return 1;
+            }
+        }
+        list = read_list(list_fd, &list_buf, &count);
+        if (manifest) close(list_fd);
+        if (!list) {
+            safe_write(STDERR_FILENO, "Error reading file list\n", 24);
+            return 1;
+        }
+        names = list;
+    }
+
+    for (int started = 0; started < nworkers; started++) {
+        if (worker_start(&workers[started], started, ring, backend, 1, -1) < 0) { // --server: SHM_EOF - конец файла, не пула
+            for (int i = 0; i < started; i++) worker_destroy(&workers[i], 1);
+            free(list);
+            free(list_buf);
+            return 1;
+        }
+    }
+
+    int rc = run_batch(workers, nworkers, names, count);
+
+    /* === ОЧИСТКА РЕСУРСОВ === */
+    for (int i = 0; i < nworkers && !pool_broken; i++) { // Сломанный пул - слоты заняты, только убить
+        worker_dispatch(&workers[i], 0, SHM_QUIT); // Дочерние в режиме --server ждут SHM_QUIT
+        worker_wait(&workers[i]);            // Счётчики простоев окончательны только после выхода
+    }
+    if (stalls) print_stalls(workers, nworkers);
+    if (stats_mode) print_stats(workers, nworkers);
+    for (int i = 0; i < nworkers; i++) worker_destroy(&workers[i], pool_broken);
+    free(list);
+    free(list_buf);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    int nworkers = 1;                        // Количество дочерних процессов (-j N)
+    int ring = 0;                            // Транспорт --ring
+    int backend = SHM_BACKEND_MEMFD;         // Бэкенд памяти --shm
+    int daemon_mode = 0;                     // --daemon
+    int client_mode = 0;                     // --client
+    int zero_copy = 0;                       // --zero-copy
+    int stalls = 0;                          // --stalls: вывести счётчики простоев
+    int batch_stdin = 0;                     // --batch: список файлов из stdin
+    const char *manifest = NULL;             // --manifest FILE: список файлов из файла
+    int nargs = 0;                           // Имена файлов в argv (сдвигаются в argv[1..nargs])
+    int pool_opts = 0;                       // Опции, задающие пул и формат: у --client их задал демон
+    int shm_set = 0;                         // --shm задан явно (демону бэкенд не выбрать)
+    static Worker workers[MAX_WORKERS];      // static - не занимаем стек (MAX_WORKERS структур)
+
+    /* === АРГУМЕНТЫ КОМАНДНОЙ СТРОКИ === */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10); // strtol() - строка в long, end указывает на символ после числа
+            if (*end != '\0' || n < 1 || n > MAX_WORKERS) {
+                safe_write(STDERR_FILENO, "Invalid -j value\n", 17);
+                return 1;
+            }
+            nworkers = (int)n;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--ring") == 0) {
+            ring = 1;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            i++;
+            pool_opts++;
+            shm_set = 1;
+            if (strcmp(argv[i], "memfd") == 0) backend = SHM_BACKEND_MEMFD;
+            else if (strcmp(argv[i], "file") == 0) backend = SHM_BACKEND_FILE;
+            else {
+                safe_write(STDERR_FILENO, "Invalid --shm value\n", 20);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sem") == 0 && i + 1 < argc) {
+            i++;
+            pool_opts++;
+            if (strcmp(argv[i], "named") == 0) sem_sync = SHM_SYNC_NAMED;
+            else if (strcmp(argv[i], "pshared") == 0) sem_sync = SHM_SYNC_PSHARED;
+            else {
+                safe_write(STDERR_FILENO, "Invalid --sem value\n", 20);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--inproc") == 0) {
+            inproc = 1;
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "--client") == 0) {
+            client_mode = 1;
+        } else if (strcmp(argv[i], "--zero-copy") == 0) {
+            zero_copy = 1;
+        } else if (strcmp(argv[i], "--stalls") == 0) {
+            stalls = 1;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_mode = 1;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch_stdin = 1;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--buf") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long long n = strtoull(argv[++i], &end, 10);
+            if (*end == 'K' || *end == 'k') n <<= 10, end++;
+            else if (*end == 'M' || *end == 'm') n <<= 20, end++;
+            if (*end != '\0' || n < SHM_CAP_MIN || n > SHM_CAP_MAX) {
+                safe_write(STDERR_FILENO, "Invalid --buf value (4K..64M)\n", 30);
+                return 1;
+            }
+            shm_cap = (size_t)n;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads_arg = argv[++i];
+            pool_opts++;
+            char *end;
+            long n = strtol(threads_arg, &end, 10);
+            if (*end != '\0' || end == threads_arg || n < 1 || n > CHILD_THREADS_MAX) {
+                safe_write(STDERR_FILENO, "Invalid --threads value\n", 24);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--decimal") == 0) {
+            decimal = 1;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--agg") == 0 && i + 1 < argc) {
+            agg_arg = argv[++i];
+            pool_opts++;
+            if (agg_parse(agg_arg) == 0) {
+                safe_write(STDERR_FILENO, "Invalid --agg list (sum,count,min,max,mean,var)\n", 48);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            columns = 1;
+            pool_opts++;
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            precision_arg = argv[++i];
+            pool_opts++;
+            if (strcmp(precision_arg, "shortest") != 0) {
+                char *end;
+                long p = strtol(precision_arg, &end, 10);
+                if (*end != '\0' || end == precision_arg || p < 0 || p > FMT_PREC_MAX) {
+                    safe_write(STDERR_FILENO, "Invalid --precision value\n", 26);
+                    return 1;
+                }
+            }
+        } else if (argv[i][0] != '-') {      // Имя входного файла: пакетный режим
+            argv[1 + nargs++] = argv[i];     // 1 + nargs <= i - перезаписываем только разобранное
+        } else {
+            safe_write(STDERR_FILENO, "Usage: parent [-j N] [--ring] [--shm memfd|file] [--sem named|pshared] [--zero-copy] [--stalls] [--stats] [--threads N | --inproc] [--buf N[K|M]] [--agg LIST] [--columns] [--decimal] [--precision N|shortest] [--follow | --daemon | --client | --batch | --manifest FILE | FILE...]\n", 279);
+            return 1;
+        }
+    }
+
+    const char *single = NULL;               // Один файл в argv без пакетного режима (--zero-copy, --follow): вывод - как у пакета
+    if (nargs == 1 && (zero_copy || follow) && !batch_stdin && !manifest) {
+        single = argv[1];
+        nargs = 0;
+    }
+    int batch = (nargs > 0) + batch_stdin + (manifest != NULL); // Источников списка файлов
+    if (batch > 1) {
+        safe_write(STDERR_FILENO, "Use only one file list: argv, --batch or --manifest\n", 52);
+        return 1;
+    }
+    if (client_mode && (pool_opts || batch)) { // Дочерние демона уже запущены с его аргументами - молча игнорировать нельзя
+        safe_write(STDERR_FILENO, "--client takes no pool/format options or file list: they are set by --daemon\n", 77);
+        return 1;
+    }
+    if (daemon_mode && (shm_set || stats_mode || stalls)) { // Демон всегда на shm_open, а сводку выводить некому
+        safe_write(STDERR_FILENO, "--daemon works only without --shm/--stats/--stalls\n", 51);
+        return 1;
+    }
+    if (zero_copy && (daemon_mode || client_mode || batch)) { // Дескриптор файла уже запущенным дочерним через execv не передать
+        safe_write(STDERR_FILENO, "--zero-copy works only with one file, without --daemon/--client/--batch/--manifest\n", 83);
+        return 1;
+    }
+
+    if (follow && (zero_copy || daemon_mode || client_mode || batch)) { // Одно отображение и один файл на запуск
+        safe_write(STDERR_FILENO, "--follow works only with one file, without --zero-copy/--daemon/--client\n", 73);
+        return 1;
+    }
+
+    if (decimal && precision_arg && strcmp(precision_arg, "shortest") == 0) { // Кратчайшая запись - свойство float
+        safe_write(STDERR_FILENO, "--decimal needs a number of digits, not --precision shortest\n", 61);
+        return 1;
+    }
+    if (inproc && (threads_arg || daemon_mode || client_mode)) { // Состояние child.c - одно на поток, без своего пула
+        safe_write(STDERR_FILENO, "--inproc works only without --threads/--daemon/--client\n", 56);
+        return 1;
+    }
+    child_path_init();
+
+    if (daemon_mode) return run_daemon(workers, nworkers, ring); // Транспорт клиента берётся у демона
+    if (client_mode) return run_client(workers);
+    ipc_instance();                          // Дальше - обычный запуск: имена только наши
+    if (batch) return main_batch(workers, nworkers, ring, backend, stalls, argv + 1, nargs, batch_stdin, manifest);
+
+    /* === ВВОД ИМЕНИ ФАЙЛА === */
+    char filename[BUF_SIZE];                 // Имя входного файла
+    int file_fd = open_input(filename, single);
+    if (file_fd < 0) return 1;
+
+    int server = follow;                     // --follow: пул переживает конец файла, стоп - SHM_QUIT
+    if (follow) {                            // Следить можно только за обычным текстовым файлом
+        struct stat st;
+        if (fstat(file_fd, &st) < 0 || !S_ISREG(st.st_mode) || is_binary(file_fd)) {
+            safe_write(STDERR_FILENO, "--follow needs a regular text file\n", 35);
+            close(file_fd);
+            return 1;
+        }
+        if (follow_start(filename) < 0) {
+            follow_stop();
+            close(file_fd);
+            return 1;
+        }
+        follow_skip(file_fd);                // Только новые строки
+    }
+
+    /* ====================================================================
+     * --zero-copy: отображение входного файла вместо read()
+     *
+     * Обычный путь копирует каждый байт входа: Page Cache -> in[] (read)
+     * и дальше дочерний разбирает in[]. Здесь дочерние получают дескриптор
+     * файла (--input N) и отображают его сами - страницы Page Cache
+     * попадают в их адресное пространство без копирования, а через
+     * SharedData идут только границы кусков и результаты.
+     * Нужен обычный файл: pipe/FIFO отобразить нельзя - тогда копируем.
+     * ==================================================================== */
+    const char *input = NULL;                // Отображение входного файла (--zero-copy)
+    size_t input_size = 0;
+    const BinHeader *bin = NULL;             // Двоичный вход (txt2bin)
+    int binary = is_binary(file_fd);
+    if (binary) zero_copy = 1;               // Двоичный файл читается только через отображение
+    if (zero_copy) {
+        struct stat st;
+        if (fstat(file_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, file_fd, 0); // Только чтение
+            if (m != MAP_FAILED) {
+                input = m;
+                input_size = (size_t)st.st_size;
+            }
+        }
+        /* Пустой файл, pipe или ошибка mmap - тихо работаем обычным путём */
+        if (binary) bin = bin_check(input, input_size);
+        if (binary && agg_arg && agg_parse(agg_arg) != AGG_SUM) { // Ядра агрегатов - для чисел из текста
+            safe_write(STDERR_FILENO, "Binary input supports only --agg sum\n", 37);
+            if (input) munmap((void *)input, input_size);
+            close(file_fd);
+            return 1;
+        }
+        if (binary && !bin) {                // Сигнатура есть, а заголовок испорчен или файл обрезан
+            safe_write(STDERR_FILENO, "Bad binary input\n", 17);
+            if (input) munmap((void *)input, input_size);
+            close(file_fd);
+            return 1;
+        }
+    }
+
+    /* === ЗАПУСК ПУЛА ДОЧЕРНИХ ПРОЦЕССОВ === */
+    int started = 0;                         // Сколько воркеров успешно запущено
+
+    for (; started < nworkers; started++) {
+        if (worker_start(&workers[started], started, ring, backend, server, input ? file_fd : -1) < 0) {
+            for (int i = 0; i < started; i++) worker_destroy(&workers[i], 1);
+            if (input) munmap((void *)input, input_size);
+            follow_stop();
+            close(file_fd);
+            return 1;
+        }
+    }
+
+    if (single) {                            // Файл из argv - та же рамка, что у пакетного режима
+        safe_write(STDOUT_FILENO, "==> ", 4);
+        safe_write(STDOUT_FILENO, single, strlen(single));
+        safe_write(STDOUT_FILENO, " <==\n", 5);
+    } else {
+        safe_write(STDOUT_FILENO, "Result:\n", 8);
+    }
+    int rc = run_file(workers, nworkers, file_fd, input, input_size, bin); // Потоковый обмен (см. run_file)
+
+    if (input) munmap((void *)input, input_size);
+    close(file_fd);                          // Файл прочитан, дескриптор больше не нужен
+    follow_stop();
+
+    /* === ОЧИСТКА РЕСУРСОВ === */
+    for (int i = 0; i < nworkers && !pool_broken; i++) { // Сломанный пул - слоты заняты, только убить
+        if (server) worker_dispatch(&workers[i], 0, SHM_QUIT); // --follow: дочерние в режиме --server
+        worker_wait(&workers[i]);            // Остальные получили SHM_EOF и выходят сами
+    }
+    if (stalls) print_stalls(workers, nworkers);
+    if (stats_mode) print_stats(workers, nworkers);
+    for (int i = 0; i < nworkers; i++) worker_destroy(&workers[i], pool_broken);
+    
+    return rc < 0 ? 1 : 0;                   // Успешное завершение (или ошибка чтения файла)
+}
@@ -0,0 +1,129 @@
+/*
+ * ============================================================================
+ * Лабораторная работа №3 - Перевод текстового входа в двоичный (txt2bin)
+ *
+ * Читает строки чисел (формат test.txt) и пишет тот же набор строк в
+ * двоичном колоночном формате (BinHeader, см. common.h). parent узнаёт
+ * такой файл по сигнатуре сам, а дочерние вместо разбора текста
+ * суммируют готовые массивы чисел векторными инструкциями.
+ *
+ * Числа разделяются пробелами и табуляциями. Пустая строка пропускается
+ * (как у child), строка из одних пробелов даёт строку без чисел ("Sum: 0.00").
+ * Нечисловой токен или переполнение - ошибка с номером строки, файл не пишется
+ * наполовину молча.
+ *
+ * Запуск: txt2bin [--f64] INPUT OUTPUT
+ *   --f64 - числа float64 (по умолчанию float32, как считает child)
+ *
+ * Числа пишутся потоком сразу после заголовка, индекс строк копится во
+ * временном файле и дописывается в конце, заголовок - последним: память
+ * не зависит от размера входа.
+ *
+ * Вспомогательный инструмент, не часть лабораторной: stdio допустим.
+ * ============================================================================
+ */
+
+#define _GNU_SOURCE                          // syscall() в common.h (futex режима --ring)
+#define _POSIX_C_SOURCE 200809L              // getline()
+
+#include <stdio.h>                           // fopen(), getline(), fwrite(), tmpfile()
+#include <stdlib.h>                          // strtof(), strtod()
+#include <string.h>                          // strcmp(), memcpy(), memset()
+#include <errno.h>                           // errno, ERANGE
+#include <stdint.h>                          // uint64_t
+
+#include "common.h"                          // BinHeader, BIN_MAGIC
+
+#define COPY_BUF (1 << 16)                   // Блок копирования индекса
+
+/* fail - сообщение об ошибке и код выхода */
+static int fail(const char *what, unsigned long long line) {
+    if (line) fprintf(stderr, "txt2bin: line %llu: %s\n", line, what);
+    else fprintf(stderr, "txt2bin: %s\n", what);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int f64 = argc == 4 && strcmp(argv[1], "--f64") == 0;
+    if (argc != 3 + f64) {
+        fprintf(stderr, "Usage: txt2bin [--f64] INPUT OUTPUT\n");
+        return 1;
+    }
+    const char *in_path = argv[1 + f64], *out_path = argv[2 + f64];
+    size_t value_size = f64 ? sizeof(double) : sizeof(float);
+
+    FILE *in = fopen(in_path, "r");
+    if (!in) return fail("cannot open input", 0);
+    FILE *out = fopen(out_path, "wb");
+    FILE *idx = tmpfile();                   // Индекс строк до конца чтения
+    if (!out || !idx) return fail("cannot create output", 0);
+
+    BinHeader h;
+    memset(&h, 0, sizeof(h));
+    if (fwrite(&h, sizeof(h), 1, out) != 1) return fail("write error", 0); // Место под заголовок
+
+    /* === ЧИСЛА: строка за строкой, сразу в выходной файл === */
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    unsigned long long lineno = 0;
+    uint64_t values = 0, rows = 0;
+    while ((len = getline(&line, &cap, in)) != -1) {
+        lineno++;
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+        if (len == 0) continue;              // Пустая строка - как у child, без результата
+
+        if (fwrite(&values, sizeof(values), 1, idx) != 1) return fail("write error", 0); // index[rows]
+        rows++;
+
+        char *p = line;
+        for (;;) {
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == '\0') break;
+
+            char *end;
+            errno = 0;
+            double d = 0;
+            float f = 0;
+            if (f64) d = strtod(p, &end);
+            else f = strtof(p, &end);
+            if (end == p || (*end != '\0' && *end != ' ' && *end != '\t')) return fail("not a number", lineno);
+            if (errno == ERANGE && (f64 ? d != 0 : f != 0)) return fail("number out of range", lineno); // Денормалы - не ошибка
+            if (fwrite(f64 ? (const void *)&d : (const void *)&f, value_size, 1, out) != 1) return fail("write error", 0);
+            values++;
+            p = end;
+        }
+    }
+    free(line);
+    if (ferror(in)) return fail("read error", 0);
+    fclose(in);
+    if (fwrite(&values, sizeof(values), 1, idx) != 1) return fail("write error", 0); // index[rows] = values
+
+    /* === ИНДЕКС: выравнивание до 8 байт и копия из временного файла === */
+    uint64_t data_end = sizeof(h) + values * value_size;
+    uint64_t index_off = (data_end + 7) & ~(uint64_t)7;
+    static const char zeros[8];
+    if (fwrite(zeros, 1, (size_t)(index_off - data_end), out) != (size_t)(index_off - data_end)) return fail("write error", 0);
+
+    static char buf[COPY_BUF];
+    size_t n;
+    rewind(idx);
+    while ((n = fread(buf, 1, sizeof(buf), idx)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) return fail("write error", 0);
+    }
+    if (ferror(idx)) return fail("read error", 0);
+    fclose(idx);
+
+    /* === ЗАГОЛОВОК: последним, когда всё известно === */
+    memcpy(h.magic, BIN_MAGIC, BIN_MAGIC_LEN);
+    h.version = BIN_VERSION;
+    h.value_size = (uint32_t)value_size;
+    h.rows = rows;
+    h.values = values;
+    h.data_off = sizeof(h);
+    h.index_off = index_off;
+    rewind(out);
+    if (fwrite(&h, sizeof(h), 1, out) != 1 || fclose(out) != 0) return fail("write error", 0);
+    return 0;
+}